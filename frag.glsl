@@ -1,10 +1,41 @@
 #version 330
 
+// Modes are compiled in: GLWidget builds a variant per combination of these
+#ifndef RADAR
+#define RADAR 0 // polar display
+#endif
+#ifndef BICUBIC
+#define BICUBIC 0 // else the sampler interpolates (nearest or bilinear)
+#endif
+#ifndef TRANSFER
+#define TRANSFER 0 // 0 linear, 1 dB re transfer_param, 2 sqrt, 3 power transfer_param
+#endif
+#ifndef VALUE
+#define VALUE(t) (t).x // the value of texel t; of the I/Q pair in .xy for complex data
+#endif
+
 in highp vec2 texCoord;
 out highp vec4 f_color;
 
-uniform sampler2D tex;
-uniform int is_radar_plot;
+#ifdef LAYERED
+flat in highp float layer;
+uniform highp sampler2DArray tex;
+#define LOOKUP(coord) textureLod(tex, highp vec3(coord, layer), lod)
+#define FETCH(p) texelFetch(tex, ivec3(p, int(layer)), 0)
+#else
+uniform highp sampler2D tex;
+#define LOOKUP(coord) textureLod(tex, coord, lod)
+#define FETCH(p) texelFetch(tex, p, 0)
+#endif
+#if BICUBIC
+#define SAMPLE(coord) bicubic(coord)
+#else
+#define SAMPLE(coord) VALUE(LOOKUP(coord))
+#endif
+uniform float lod;
+uniform float transfer_param;
+uniform float gain; // intensity = transfer(value) * gain + offset, for auto contrast
+uniform float offset;
 
 const float PI = 3.1415926535897932384626433832795;
 
@@ -40,6 +71,50 @@ highp vec3 double_rainbow_rgb(float intensity)
 	return rainbow_table(int(c1)) * s1 + rainbow_table(int(c2)) * s2;
 }
 
+highp vec4 catmull_rom(highp float t)
+{
+	highp float t2 = t * t;
+	highp float t3 = t2 * t;
+	return highp vec4(-0.5 * t3 + t2 - 0.5 * t, 1.5 * t3 - 2.5 * t2 + 1.0, -1.5 * t3 + 2.0 * t2 + 0.5 * t, 0.5 * t3 - 0.5 * t2);
+}
+
+// Catmull-Rom over 4x4 texels of the base level, for formats without filtering
+highp float bicubic(highp vec2 coord)
+{
+	ivec2 size = textureSize(tex, 0).xy;
+	highp vec2 p = coord * highp vec2(size) - 0.5;
+	highp vec2 f = fract(p);
+	ivec2 base = ivec2(floor(p)) - 1;
+	highp vec4 wx = catmull_rom(f.x);
+	highp vec4 wy = catmull_rom(f.y);
+
+	highp float sum = 0.0;
+	for (int j = 0; j < 4; ++j)
+	{
+		highp float row = 0.0;
+		for (int i = 0; i < 4; ++i)
+		{
+			ivec2 q = clamp(base + ivec2(i, j), ivec2(0), size - 1);
+			row += wx[i] * VALUE(FETCH(q));
+		}
+		sum += wy[j] * row;
+	}
+	return sum;
+}
+
+float apply_transfer(float v)
+{
+#if TRANSFER == 1
+	return 3.0103 * log2(max(v, 1e-30) / transfer_param); // 10 log10
+#elif TRANSFER == 2
+	return sqrt(max(v, 0.0));
+#elif TRANSFER == 3
+	return pow(max(v, 0.0), transfer_param);
+#else
+	return v;
+#endif
+}
+
 void main()
 {
 	float RadiusMin = 0.0f;
@@ -50,18 +125,15 @@ void main()
 
 	float intensity = 0.0f;
 
-	if (is_radar_plot != 0)
-	{
-		float r = length(normCoord);
-		float theta = (atan(normCoord.y, normCoord.x) / (2 * PI) + 0.5);
+#if RADAR
+	float r = length(normCoord);
+	float theta = (atan(normCoord.y, normCoord.x) / (2 * PI) + 0.5);
 
-		normCoord = highp vec2(r, theta);
-		intensity = float(r <= RadiusMax) * texture(tex, normCoord).x;
-	}
-	else
-	{
-		intensity = texture(tex, texCoord).x;
-	}
+	normCoord = highp vec2(r, theta);
+	intensity = float(r <= RadiusMax) * (apply_transfer(SAMPLE(normCoord)) * gain + offset);
+#else
+	intensity = apply_transfer(SAMPLE(texCoord)) * gain + offset;
+#endif
 
 	highp vec3 color = double_rainbow_rgb(intensity);
 	f_color = highp vec4(color, 1.0);
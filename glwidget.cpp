@@ -1,20 +1,23 @@
 #include "glwidget.h"
+#include "uploadcontext.h"
 #include <QCoreApplication>
+#include <QFile>
 #include <QMouseEvent>
 #include <QOpenGLPixelTransferOptions>
 #include <QOpenGLShaderProgram>
-#include <math.h>
+#include <QWheelEvent>
+#include <cmath>
 
 #include <iostream>
 #include <memory>
 
-template <typename T>
-struct UploadJob
-{
-	int start_row_idx;
-	int current_row_idx;
-	std::vector<std::shared_ptr<std::vector<T>>> data;
-};
+// GL 3.3 / EXT_disjoint_timer_query, which the ES 3.0 headers lack
+#ifndef GL_TIME_ELAPSED
+#define GL_TIME_ELAPSED 0x88BF
+#endif
+#ifndef GL_GPU_DISJOINT_EXT
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+#endif
 
 void GLAPIENTRY MessageCallback(GLenum, GLenum type, GLuint, GLenum severity, GLsizei, const GLchar* message, const void*)
 {
@@ -26,50 +29,144 @@ void GLAPIENTRY MessageCallback(GLenum, GLenum type, GLuint, GLenum severity, GL
 			message);
 }
 
-GLWidget::GLWidget(size_t rows, size_t cols, QWidget* parent)
+GLWidget::GLWidget(size_t rows, size_t cols, int layers, int components, QWidget* parent)
 	: QOpenGLWidget(parent)
-	, tex_width(cols)
-	, tex_height(rows)
-	, upload_idx(1)
-	, copy_idx(0)
-	, upload_time(0.0)
-	, copy_time(0.0)
+	, uploader(rows, cols, layers, components)
+	, upload_context(UploadContext::instance())
+	, m_program(nullptr)
 	, time_cnt(0)
+	, first_frame_pending(false)
+	, n_contexts(0)
 	, is_radar_plot(false)
-	, input_qs{{UploadQueue(tex_height), UploadQueue(tex_height)}}
+	, view_zoom(1.f)
+	, view_center_s(0.5f)
+	, view_center_t(0.5f)
+	, lod(0)
+	, transfer(Transfer::Linear)
+	, transfer_param(1.f)
+	, db_floor(-60.f)
+	, db_ceiling(0.f)
+	, interpolation(Interpolation::Nearest)
+	, complex_view(ComplexView::Magnitude)
+	, sampler(0)
+	, draw_queries{{0, 0}}
+	, draw_query_cnt(0)
+	, draw_time(0.0)
+	, auto_contrast(false)
+	, gpu_stats(false)
+	, reduction_failed(false)
+	, gain(1.f)
+	, offset(0.f)
+	, grid_cols(int(std::ceil(std::sqrt(double(uploader.layerCount())))))
+	, grid_rows((uploader.layerCount() + grid_cols - 1) / grid_cols)
 	, n_paint(0)
 {
+	drain_timer.setInterval(stall_ms / 2);
+	connect(&drain_timer, &QTimer::timeout, this, &GLWidget::drain_if_stalled);
+	since_paint.start();
 }
 
-GLWidget::~GLWidget() { cleanup(); }
+GLWidget::~GLWidget()
+{
+	cleanup();
+	// gone after aboutToQuit, which released the uploader with all others
+	if (upload_context && UploadContext::instance())
+	{
+		upload_context->remove(&uploader);
+	}
+}
 
 QSize GLWidget::minimumSizeHint() const { return QSize(50, 50); }
 
 QSize GLWidget::sizeHint() const { return QSize(400, 400); }
 
+void GLWidget::set_ingest_policy(MatrixUploader::IngestPolicy policy)
+{
+	uploader.set_ingest_policy(policy);
+	if (policy == MatrixUploader::IngestPolicy::DrainToShadow)
+		drain_timer.start();
+	else
+		drain_timer.stop();
+}
+
+void GLWidget::drain_if_stalled()
+{
+	// hidden, minimized or obscured widgets aren't painted, so nothing drains the queues
+	if (since_paint.elapsed() > stall_ms)
+	{
+		uploader.drain_to_shadow();
+	}
+}
+
+/// The transfer function of frag.glsl, for mapping contrast limits
+static float apply_transfer(GLWidget::Transfer transfer, float param, float v)
+{
+	switch (transfer)
+	{
+	case GLWidget::Transfer::Decibel:
+		return 10.f * std::log10(std::max(v, 1e-30f) / param);
+	case GLWidget::Transfer::Sqrt:
+		return std::sqrt(std::max(v, 0.f));
+	case GLWidget::Transfer::Gamma:
+		return std::pow(std::max(v, 0.f), param);
+	case GLWidget::Transfer::Linear:
+		break;
+	}
+	return v;
+}
+
+/// The VALUE() of the shaders: what is shown of a texel t
+static const char* value_expression(int components, GLWidget::ComplexView view)
+{
+	if (components == 1)
+		return "(t).x";
+	switch (view)
+	{
+	case GLWidget::ComplexView::LogMagnitude:
+		return "(3.0103 * log2(max(dot((t).xy, (t).xy), 1e-30)))"; // 10 log10 |z|^2
+	case GLWidget::ComplexView::Phase:
+		return "atan((t).y, (t).x)";
+	case GLWidget::ComplexView::Magnitude:
+		break;
+	}
+	return "length((t).xy)";
+}
+
 void GLWidget::cleanup()
 {
 	if (m_program == nullptr)
 		return;
 	makeCurrent();
 
-	// clean up texture
-	glDeleteTextures(1, &textureId);
-
-	// clean up PBOs
-	for (auto& el : input_qs)
+	// clean up textures and the staging ring; shared ones outlive our context
+	if (!upload_context)
+	{
+		uploader.destroy();
+	}
+	if (reduction)
+	{
+		reduction->destroy();
+		reduction.reset();
+	}
+	glDeleteSamplers(1, &sampler);
+	sampler = 0;
+	if (draw_queries[0])
 	{
-		glDeleteBuffers(1, &el.pbo_id);
+		glDeleteQueries(draw_queries.size(), draw_queries.data());
+		draw_queries = {{0, 0}};
 	}
 
-	m_program = 0;
+	programs.clear();
+	m_program = nullptr;
 	doneCurrent();
 }
 
 /// A vertex shader, which generates our full screen triangle
-/// and it's texture
+/// and it's texture coordinates within the current view rectangle
 static const char* vertexShaderSource = "#version 330\n"
 										"out vec2 texCoord;\n"
+										"uniform vec2 view_offset;\n"
+										"uniform vec2 view_scale;\n"
 										" \n"
 										"void main()\n"
 										"{\n"
@@ -77,9 +174,29 @@ static const char* vertexShaderSource = "#version 330\n"
 										"    float y = -1.0 + float((gl_VertexID & 2) << 1);\n"
 										"    texCoord.x = (y+1.0)*0.5;\n"
 										"    texCoord.y = (x+1.0)*0.5;\n"
+										"    texCoord = view_offset + texCoord * view_scale;\n"
 										"    gl_Position = vec4(x, y, 0, 1);\n"
 										"}";
 
+/// Vertex shader for several layers: instance i is a quad (triangle strip)
+/// covering grid cell i, which samples layer i
+static const char* layeredVertexShaderSource = "#version 330\n"
+											   "out vec2 texCoord;\n"
+											   "flat out float layer;\n"
+											   "uniform vec2 view_offset;\n"
+											   "uniform vec2 view_scale;\n"
+											   "uniform ivec2 grid;\n"
+											   " \n"
+											   "void main()\n"
+											   "{\n"
+											   "    vec2 corner = vec2(gl_VertexID & 1, (gl_VertexID >> 1) & 1);\n"
+											   "    vec2 cell = vec2(gl_InstanceID % grid.x, grid.y - 1 - gl_InstanceID / grid.x);\n"
+											   "    vec2 pos = 2.0 * (cell + corner) / vec2(grid) - 1.0;\n"
+											   "    texCoord = view_offset + corner.yx * view_scale;\n"
+											   "    layer = float(gl_InstanceID);\n"
+											   "    gl_Position = vec4(pos, 0, 1);\n"
+											   "}";
+
 void GLWidget::initializeGL()
 {
 	// In this example the widget's corresponding top-level window can change
@@ -90,6 +207,9 @@ void GLWidget::initializeGL()
 	// the signal will be followed by an invocation of initializeGL() where we
 	// can recreate all resources.
 	connect(context(), &QOpenGLContext::aboutToBeDestroyed, this, &GLWidget::cleanup);
+	since_init.start();
+	first_frame_pending = true;
+	++n_contexts;
 
 	initializeOpenGLFunctions();
 
@@ -103,11 +223,12 @@ void GLWidget::initializeGL()
 
 	glClearColor(0, 0, 0, 1);
 
-	m_program = std::make_unique<QOpenGLShaderProgram>();
-	m_program->addShaderFromSourceCode(QOpenGLShader::Vertex, vertexShaderSource);
-	m_program->addShaderFromSourceFile(QOpenGLShader::Fragment, "frag.glsl");
-	m_program->bindAttributeLocation("texCoord", 0);
-	m_program->link();
+	QFile frag_file("frag.glsl");
+	if (frag_file.open(QIODevice::ReadOnly))
+	{
+		frag_source = frag_file.readAll();
+	}
+	m_program = shader_variant();
 	m_program->bind();
 
 	// Create a vertex array object. In OpenGL ES 2.0 and OpenGL 2.x
@@ -117,176 +238,449 @@ void GLWidget::initializeGL()
 	m_vao.create();
 	QOpenGLVertexArrayObject::Binder vaoBinder(&m_vao);
 
-	initBuffers();
-	initTexture();
-	fps.start();
-
-	m_program->release();
-}
+	if (upload_context)
+	{
+		upload_context->add(&uploader);
+	}
+	else
+	{
+		uploader.initialize(false);
+	}
 
-void GLWidget::initBuffers()
-{
-	const size_t DATA_SIZE = dataCount() * sizeof(GLfloat);
-	for (auto& el : input_qs)
+	glGenSamplers(1, &sampler);
+	glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	// ES has timer queries with the extension only, through the ES 3.0 query functions
+	if (!context()->isOpenGLES() || context()->hasExtension(QByteArrayLiteral("GL_EXT_disjoint_timer_query")))
+	{
+		glGenQueries(draw_queries.size(), draw_queries.data());
+	}
+	else
 	{
-		glGenBuffers(1, &el.pbo_id);
-		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, el.pbo_id);
-		glBufferData(GL_PIXEL_UNPACK_BUFFER, DATA_SIZE, 0, GL_STREAM_DRAW);
+		std::cerr << "No timer queries on this context, the GPU time of draws isn't measured\n";
 	}
-	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	draw_query_cnt = 0;
+	fps.start();
+
+	m_program->release();
 }
 
 void GLWidget::paintGL()
 {
 	++n_paint;
-	std::swap(copy_idx, upload_idx);
-
-	auto call_with_timer = [this](double& accum, auto fn) {
-		timer.start();
-		fn();
-		double elapsed = timer.elapsed() * 1e-3;
-		accum = (time_cnt > 0) ? 0.9 * accum + 0.1 * elapsed : elapsed;
-	};
+	since_paint.restart();
+
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_CULL_FACE);
 
-	/* PBO stuff start */
-
-	call_with_timer(copy_time, [this] { copy_frontbuffer_to_texture(); });
-	call_with_timer(upload_time, [this] { process_upload_queue(); });
-
-	/* PBO stuff end */
+	update_lod();
+	update_contrast();
+	if (upload_context)
+	{
+		// the upload runs in the background, we sample what it finished last
+		upload_context->request_upload(&uploader);
+	}
+	else
+	{
+		uploader.upload();
+	}
 
-	// it is good idea to release PBOs with ID 0 after use.
-	// Once bound with 0, all pixel operations behave normal ways.
-	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	const MatrixUploader::TextureView texture = uploader.acquire_texture();
+	if (texture.id == 0)
+	{
+		return; // no upload finished yet
+	}
 
 	QOpenGLVertexArrayObject::Binder vaoBinder(&m_vao);
+	m_program = shader_variant();
 	m_program->bind();
 	m_program->setUniformValue("tex", 0);
-	m_program->setUniformValue("is_radar_plot", static_cast<GLint>(is_radar_plot));
+	m_program->setUniformValue("view_offset", view_center_s - 0.5f / view_zoom, view_center_t - 0.5f / view_zoom);
+	m_program->setUniformValue("view_scale", 1.f / view_zoom, 1.f / view_zoom);
+	m_program->setUniformValue("lod", static_cast<GLfloat>(texture.mipmapped ? lod : 0));
+	m_program->setUniformValue("transfer_param", transfer_param);
+	m_program->setUniformValue("gain", gain);
+	m_program->setUniformValue("offset", offset);
+
+	// while a texture isn't converted to a filterable format yet, it is drawn unfiltered
+	const bool linear = interpolation == Interpolation::Bilinear && texture.filterable;
+	glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, linear ? GL_LINEAR : GL_NEAREST);
+	glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER,
+			texture.mipmapped ? (linear ? GL_LINEAR_MIPMAP_NEAREST : GL_NEAREST_MIPMAP_NEAREST)
+							  : (linear ? GL_LINEAR : GL_NEAREST));
+	glBindSampler(0, sampler);
+
+	if (draw_queries[0])
+	{
+		// the query of the previous frame is usually done by now; don't wait for it
+		GLuint query = draw_queries[(draw_query_cnt + 1) % 2];
+		GLuint available = 0;
+		if (draw_query_cnt > 0)
+			glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available)
+		{
+			GLuint ns = 0;
+			glGetQueryObjectuiv(query, GL_QUERY_RESULT, &ns);
+			// on ES, e.g. a frequency change in between invalidates the results; reading the flag clears it
+			GLint disjoint = 0;
+			if (context()->isOpenGLES())
+				glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+			if (!disjoint)
+				draw_time = draw_time > 0 ? 0.9 * draw_time + 0.1 * ns * 1e-9 : ns * 1e-9;
+		}
+		glBeginQuery(GL_TIME_ELAPSED, draw_queries[draw_query_cnt % 2]);
+	}
 
-	glBindTexture(GL_TEXTURE_2D, textureId);
-	glDrawArrays(GL_TRIANGLES, 0,
-			3);                      // 3, since we draw a single full screen triangle
-	glBindTexture(GL_TEXTURE_2D, 0); // unbind
+	const GLenum target = uploader.textureTarget();
+	glBindTexture(target, texture.id);
+	if (layerCount() > 1)
+	{
+		// all matrices in one draw: a quad per layer
+		m_program->setUniformValue("grid", grid_cols, grid_rows);
+		glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, layerCount());
+	}
+	else
+	{
+		glDrawArrays(GL_TRIANGLES, 0,
+				3); // 3, since we draw a single full screen triangle
+	}
+	glBindTexture(target, 0); // unbind
+	glBindSampler(0, 0);
+	if (draw_queries[0])
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		++draw_query_cnt;
+	}
+
+	if (stats_on_gpu())
+	{
+		if (!reduction)
+		{
+			reduction = std::make_unique<GpuReduction>();
+			if (!reduction->initialize(uploader.texelColumnCount(), layerRowCount(), layerCount(),
+						value_expression(componentCount(), complex_view)))
+			{
+				reduction.reset();
+				reduction_failed = true;
+				update_stats_source();
+			}
+		}
+		if (reduction)
+		{
+			const qreal dpr = devicePixelRatioF();
+			reduction->run(texture.id, defaultFramebufferObject(), int(width() * dpr), int(height() * dpr));
+			m_program->bind();
+		}
+	}
+	uploader.release_texture();
+
+	if (first_frame_pending)
+	{
+		// after a re-creation, this frame already shows the matrix restored from the shadow copy
+		first_frame_pending = false;
+		std::cout << (n_contexts > 1 ? "Context re-created: " : "Context created: ") << uploader.initTime() * 1e3
+				  << "ms to initialize the uploader, " << since_init.elapsed() << "ms to the first frame\n";
+	}
 
 	m_program->release();
 	++time_cnt;
 	if (time_cnt % 1000 == 0)
 	{
 		float ms = fps.elapsed() * 1e-3;
-		std::cout << "Copy time: " << copy_time << "s\n"
-				  << "Upload time: " << upload_time << "s\n"
+		std::cout << "Copy time: " << uploader.copyTime() << "s for " << uploader.uploadRanges() << " rectangles\n"
+				  << "Upload time: " << uploader.uploadTime() << "s for " << uploader.uploadRows() << " rows\n"
+				  << "Staging: " << MatrixUploader::strategyName(uploader.uploadStrategy()) << ", "
+				  << uploader.stagingBytes() / 1024 << " KiB ring, " << uploader.stagingWaitTime()
+				  << "s waiting for the GPU\n"
 				  << "FPS: " << n_paint / ms << "\n";
+		static const char* interpolation_names[] = {"nearest", "bilinear", "bicubic"};
+		std::cout << "Draw: ";
+		if (draw_queries[0])
+			std::cout << draw_time << "s on the GPU, ";
+		else
+			std::cout << "GPU time unavailable (no timer queries), ";
+		std::cout << interpolation_names[int(interpolation)] << " at " << int(width() * devicePixelRatioF()) << "x"
+				  << int(height() * devicePixelRatioF()) << "\n";
+		if (intensity.valid)
+		{
+			std::cout << "Intensity: " << intensity.min << " .. " << intensity.max << ", mean " << intensity.mean
+					  << "\n";
+		}
+		if (uploader.droppedRows() || uploader.collapsedRows() || uploader.drainedRows() || uploader.sparseRows())
+		{
+			std::cout << "Ingest: " << uploader.droppedRows() << " writes dropped, " << uploader.collapsedRows()
+					  << " collapsed, " << uploader.drainedRows() << " drained off-screen, " << uploader.sparseRows()
+					  << " rows queued sparse\n";
+		}
+		if (reduction)
+		{
+			std::cout << "GPU statistics: " << reduction->dispatchTime() << "s to issue, " << reduction->gpuTime()
+					  << "s on the GPU, " << reduction->latency() << " frames latency\n";
+		}
 		fps.start();
 		n_paint = 0;
 	}
 }
 
+QOpenGLShaderProgram* GLWidget::shader_variant()
+{
+	const bool bicubic = interpolation == Interpolation::Bicubic;
+	const Transfer applied = appliedTransfer();
+	const int key = int(is_radar_plot) | int(bicubic) << 1 | int(applied) << 2 | int(complex_view) << 4;
+	std::unique_ptr<QOpenGLShaderProgram>& program = programs[key];
+	if (program)
+	{
+		return program.get();
+	}
+
+	const bool layered = layerCount() > 1;
+	std::string defines = "#define RADAR " + std::to_string(int(is_radar_plot)) + "\n" +
+			"#define BICUBIC " + std::to_string(int(bicubic)) + "\n" +
+			"#define TRANSFER " + std::to_string(int(applied)) + "\n" +
+			"#define VALUE(t) " + value_expression(componentCount(), complex_view) + "\n";
+	if (layered)
+	{
+		defines += "#define LAYERED\n"; // the sampler2DArray path
+	}
+	// defines have to follow #version
+	QByteArray source = frag_source;
+	source.insert(source.indexOf('\n') + 1, defines.c_str());
+
+	// cacheable: Qt stores the linked program binary on disk, so later starts don't compile again
+	program = std::make_unique<QOpenGLShaderProgram>();
+	program->addCacheableShaderFromSourceCode(
+			QOpenGLShader::Vertex, layered ? layeredVertexShaderSource : vertexShaderSource);
+	program->addCacheableShaderFromSourceCode(QOpenGLShader::Fragment, source);
+	program->bindAttributeLocation("texCoord", 0);
+	if (!program->link())
+	{
+		std::cerr << "Shader variant " << key << " doesn't link:\n" << program->log().toStdString() << "\n";
+	}
+	return program.get();
+}
+
 void GLWidget::resizeGL(int, int) {}
 
-void GLWidget::mousePressEvent(QMouseEvent*) {}
+void GLWidget::mousePressEvent(QMouseEvent* event) { last_mouse_pos = event->pos(); }
+
+void GLWidget::mouseMoveEvent(QMouseEvent* event)
+{
+	if (!(event->buttons() & Qt::LeftButton) || width() <= 0 || height() <= 0)
+		return;
 
-void GLWidget::mouseMoveEvent(QMouseEvent*) {}
+	// drag the content along with the cursor; screen y grows downwards, s upwards
+	const QPoint delta = event->pos() - last_mouse_pos;
+	const QSizeF cell = cellSize();
+	last_mouse_pos = event->pos();
+	set_view(view_zoom,
+			view_center_s + float(delta.y() / (cell.height() * view_zoom)),
+			view_center_t - float(delta.x() / (cell.width() * view_zoom)));
+}
 
-void GLWidget::openGLErrorRecieved(const QOpenGLDebugMessage& debugMessage)
+void GLWidget::mouseDoubleClickEvent(QMouseEvent*) { reset_view(); }
+
+void GLWidget::wheelEvent(QWheelEvent* event)
 {
-	qDebug() << debugMessage << "\n";
+	if (width() <= 0 || height() <= 0)
+		return;
+
+	// zoom around the cursor: keep the texel below it in place, within its cell
+	const QSizeF cell = cellSize();
+	const float bs = 1.f - float(std::fmod(event->position().y(), cell.height()) / cell.height());
+	const float bt = float(std::fmod(event->position().x(), cell.width()) / cell.width());
+	const float s = view_center_s + (bs - 0.5f) / view_zoom;
+	const float t = view_center_t + (bt - 0.5f) / view_zoom;
+
+	const float zoom = view_zoom * std::pow(2.f, event->angleDelta().y() / 480.f); // 4 notches per octave
+	set_view(zoom, s - (bs - 0.5f) / zoom, t - (bt - 0.5f) / zoom);
+	event->accept();
 }
 
-void GLWidget::initTexture()
+/// The slider positions of a view, in 1/100 octave and 1/pan_max of the matrix
+static int zoom_level(float zoom) { return int(std::lround(100.f * std::log2(zoom))); }
+static int pan_pos(float center) { return int(std::lround(center * GLWidget::pan_max)); }
+
+/* The sliders echo every change of the view back through these; a position
+ * the view already rounds to is ignored, so wheel zoom and dragging aren't
+ * snapped to the slider steps.
+ */
+void GLWidget::set_zoom(int level)
 {
-	glGenTextures(1, &textureId);
-	glBindTexture(GL_TEXTURE_2D, textureId);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, tex_width, tex_height, 0, GL_RED, GL_FLOAT, nullptr);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	if (level != zoom_level(view_zoom))
+		set_view(std::pow(2.f, level / 100.f), view_center_s, view_center_t);
 }
 
-void GLWidget::copy_frontbuffer_to_texture()
+void GLWidget::set_row_pan(int pos)
 {
-	// bind the texture and PBO
-	glBindTexture(GL_TEXTURE_2D, textureId);
-	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, input_qs[copy_idx].pbo_id);
+	if (pos != pan_pos(view_center_t))
+		set_view(view_zoom, view_center_s, float(pos) / pan_max);
+}
 
-	// copy pixels from PBO to texture object
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, tex_width, tex_height, GL_RED, GL_FLOAT, 0);
+void GLWidget::set_column_pan(int pos)
+{
+	if (pos != pan_pos(view_center_s))
+		set_view(view_zoom, float(pos) / pan_max, view_center_t);
 }
 
-void GLWidget::process_upload_queue()
+void GLWidget::reset_view() { set_view(1.f, 0.5f, 0.5f); }
+
+void GLWidget::set_view(float zoom, float center_s, float center_t)
 {
-	UploadQueue& active_queue = input_qs[upload_idx];
+	const int old_level = zoom_level(view_zoom);
+	const int old_s = pan_pos(view_center_s);
+	const int old_t = pan_pos(view_center_t);
+
+	view_zoom = std::min(std::max(zoom, 1.f), std::pow(2.f, zoom_level_max / 100.f));
+	const float half = 0.5f / view_zoom;
+	view_center_s = std::min(std::max(center_s, half), 1.f - half);
+	view_center_t = std::min(std::max(center_t, half), 1.f - half);
+
+	if (zoom_level(view_zoom) != old_level)
+		emit zoom_changed(zoom_level(view_zoom));
+	if (pan_pos(view_center_s) != old_s)
+		emit column_pan_changed(pan_pos(view_center_s));
+	if (pan_pos(view_center_t) != old_t)
+		emit row_pan_changed(pan_pos(view_center_t));
+	update();
+}
 
-	/* Basic idea:
-	 *
-	 * - Find contiguous matrix rows for upload.
-	 * - previous row, if the currend row is the same.
-	 * - If there is a gap or we reached the end of the matrix, upload what we have so far.
-	 * - Try again, until we reached the end of the matrix
+void GLWidget::update_lod()
+{
+	/* Level of detail:
 	 *
+	 * When zoomed out, several texels fall onto one pixel and nearest sampling
+	 * of the base level strides through the texture. Sampling a mip level with
+	 * about one texel per pixel instead keeps the fragment stage from being
+	 * bound by texture bandwidth; the uploader regenerates the chain in a
+	 * single pass and only while it is in use.
 	 */
+	const QSizeF cell = cellSize();
+	const float px_rows = cell.width() * devicePixelRatioF() * view_zoom;
+	const float px_cols = cell.height() * devicePixelRatioF() * view_zoom;
+	const float texels_per_px = (px_rows > 0 && px_cols > 0)
+			? std::max(layerRowCount() / px_rows, uploader.texelColumnCount() / px_cols)
+			: 1.f;
+
+	lod = texels_per_px >= 2.f ? std::min(int(std::log2(texels_per_px)), uploader.maxLod()) : 0;
+	if (componentCount() > 1)
+	{
+		// mip levels would average I and Q, and averaging complex samples cancels their phases
+		lod = 0;
+	}
+	uploader.set_mipmaps_wanted(lod > 0);
+}
+
+void GLWidget::update_stats_source()
+{
+	uploader.set_stats_enabled(auto_contrast && !stats_on_gpu() && componentCount() == 1);
+}
 
-	int current_idx = 0;
-	while (active_queue.input_q.size_approx() > 0 && active_queue.input_q.peek()->matrix_row >= current_idx)
+void GLWidget::set_auto_contrast(int state)
+{
+	auto_contrast = state != 0;
+	update_stats_source();
+	if (!auto_contrast)
 	{
-		UploadJob<T> job;
-		job.start_row_idx = active_queue.input_q.peek()->matrix_row;
-		job.current_row_idx = -1;
+		intensity = IntensitySummary();
+		destroy_reduction();
+	}
+	update();
+}
 
-		UploadQueue::Entry e;
-		current_idx = job.start_row_idx;
-		while (current_idx < tex_height && active_queue.input_q.size_approx() > 0 &&
-				active_queue.input_q.peek()->matrix_row >= current_idx && active_queue.input_q.try_dequeue(e))
-		{
-			assert(e.values->size() >= tex_width);
+void GLWidget::set_transfer(int index)
+{
+	transfer = (index >= 0 && index <= int(Transfer::Gamma)) ? Transfer(index) : Transfer::Linear;
+	update();
+}
 
-			if (job.current_row_idx == current_idx)
-			{
-				// previous insert was for this row, too; skip it
-				job.data.pop_back();
-			}
-			job.data.emplace_back(e.values);
-			job.current_row_idx = current_idx;
-			++current_idx;
-		}
+void GLWidget::set_transfer_param(double param)
+{
+	transfer_param = param > 0 ? float(param) : 1.f;
+	update();
+}
 
-		if (job.data.size() > 0)
-		{
-			upload_to_pbo(active_queue.pbo_id, job.start_row_idx, job.data);
-		}
-	} // while data in queue
+void GLWidget::set_db_range(double floor, double ceiling)
+{
+	if (ceiling > floor)
+	{
+		db_floor = float(floor);
+		db_ceiling = float(ceiling);
+	}
+	update();
+}
+
+void GLWidget::set_interpolation(int index)
+{
+	interpolation = (index >= 0 && index <= int(Interpolation::Bicubic)) ? Interpolation(index) : Interpolation::Nearest;
+	uploader.set_filtering_wanted(interpolation == Interpolation::Bilinear);
+	update();
 }
 
-bool GLWidget::upload_to_pbo(GLuint pbo_id, int start_row_idx, const std::vector<RowPtr>& data)
+void GLWidget::set_gpu_stats(int state)
 {
-	const size_t row_bytes = tex_width * sizeof(T);
-	const size_t start_byte_offset = start_row_idx * row_bytes;
-	const size_t upload_size = data.size() * row_bytes;
+	gpu_stats = state != 0;
+	reduction_failed = false; // asked again, try again
+	update_stats_source();
+	if (!stats_on_gpu())
+	{
+		destroy_reduction();
+	}
+}
 
-	// bind PBO to update pixel values
-	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo_id);
+void GLWidget::set_complex_view(int index)
+{
+	complex_view = (index >= 0 && index <= int(ComplexView::Phase)) ? ComplexView(index) : ComplexView::Magnitude;
+	// its shaders compute the old view, the next frame builds a new one
+	destroy_reduction();
+	update();
+}
 
-	// map the buffer object into client's memory
-	auto* ptr = (GLfloat*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, start_byte_offset, upload_size, GL_MAP_WRITE_BIT);
-	if (ptr)
+void GLWidget::destroy_reduction()
+{
+	if (reduction)
 	{
-		for (size_t i = 0; i < data.size(); i++)
-		{
-			const Row& row = *data[i];
-			assert(row.size() >= tex_width);
-			memcpy(ptr + i * tex_width, row.data(), row_bytes);
-		}
-		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER); // release pointer to mapping buffer
-		return true;
+		makeCurrent();
+		reduction->destroy();
+		reduction.reset();
+		doneCurrent();
 	}
-	else
+}
+
+void GLWidget::update_contrast()
+{
+	if (stats_on_gpu() && reduction)
+	{
+		// read back from an earlier frame's reduction
+		intensity = reduction->summary(contrast_low_quantile, contrast_high_quantile);
+	}
+	else if (auto_contrast)
+	{
+		// a summary merges small per-producer histograms, no pass over the matrix
+		intensity = uploader.intensitySummary(contrast_low_quantile, contrast_high_quantile);
+	}
+	if (!auto_contrast)
 	{
-		std::cerr << "Mapping buffer didn't work :/\n";
-		return false;
+		// dB are mostly negative, in a linear mapping all but the loudest values would be black
+		const bool db = showsDecibels();
+		gain = db ? 1.f / (db_ceiling - db_floor) : 1.f;
+		offset = db ? -db_floor * gain : 0.f;
+		return;
 	}
+	if (!intensity.valid)
+		return;
+
+	// the statistics are of the raw values; transfer functions are monotonic, so map the quantiles
+	const float low = apply_transfer(appliedTransfer(), transfer_param, intensity.low);
+	const float high = apply_transfer(appliedTransfer(), transfer_param, intensity.high);
+	const float range = high - low;
+	gain = range > 0.f ? 1.f / range : 1.f;
+	offset = -low * gain;
+}
+
+QSizeF GLWidget::cellSize() const { return QSizeF(double(width()) / grid_cols, double(height()) / grid_rows); }
+
+void GLWidget::openGLErrorRecieved(const QOpenGLDebugMessage& debugMessage)
+{
+	qDebug() << debugMessage << "\n";
 }
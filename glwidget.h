@@ -8,122 +8,248 @@
 #include <QOpenGLTexture>
 #include <QOpenGLVertexArrayObject>
 #include <QOpenGLWidget>
+#include <QElapsedTimer>
 #include <QTime>
+#include <QTimer>
 
 #include <QtGui/QImage>
 #include <array>
 #include <iostream>
+#include <map>
 #include <memory>
 
-#include <lockfree_q/readerwriterqueue.h>
+#include "gpureduction.h"
+#include "matrixuploader.h"
 
 QT_FORWARD_DECLARE_CLASS(QOpenGLShaderProgram)
 
+class UploadContext;
+
 class GLWidget : public QOpenGLWidget, protected QOpenGLExtraFunctions
 {
 	Q_OBJECT
 
 public:
-	using T = float;
-	using Row = std::vector<T>;
-	using RowPtr = std::shared_ptr<Row>;
+	using T = MatrixUploader::T;
+	using Row = MatrixUploader::Row;
+	using RowPtr = MatrixUploader::RowPtr;
+	using SparseRow = MatrixUploader::SparseRow;
+	using Producer = MatrixUploader::Producer;
+
+	/// Applied to the values in the shader, before contrast and colour map
+	enum class Transfer
+	{
+		Linear,
+		Decibel, ///< 10 log10(value / param)
+		Sqrt,
+		Gamma, ///< value^param
+	};
+
+	/// What is shown of complex samples, computed in the shader from the I/Q pair
+	enum class ComplexView
+	{
+		Magnitude,
+		LogMagnitude, ///< 20 log10 |z|
+		Phase,        ///< in radians, -pi..pi
+	};
+
+	enum class Interpolation
+	{
+		Nearest,
+		Bilinear, ///< texture filtering, R16F textures where R32F isn't filterable
+		Bicubic,  ///< Catmull-Rom from 16 texel fetches in the shader, any format
+	};
 
-	GLWidget(size_t rows, size_t cols, QWidget* parent = 0);
+	/* With several layers, the widget shows that many rows x cols matrices as
+	 * a grid. With two components, the matrices hold complex samples, rows of
+	 * cols interleaved I/Q pairs; see MatrixUploader.
+	 */
+	GLWidget(size_t rows, size_t cols, int layers = 1, int components = 1, QWidget* parent = 0);
 	~GLWidget();
 
 	QSize minimumSizeHint() const override;
 	QSize sizeHint() const override;
 
-	size_t dataCount() const { return tex_width * tex_height; }
+	size_t dataCount() const { return uploader.dataCount(); }
+	/// Rows of all layers; layer l starts at row l * layerRowCount()
+	int rowCount() const { return uploader.rowCount(); }
+	int columnCount() const { return uploader.columnCount(); }
+	int layerCount() const { return uploader.layerCount(); }
+	int layerRowCount() const { return uploader.layerRowCount(); }
+	int componentCount() const { return uploader.componentCount(); }
+	/// Writes not yet drained by an upload
+	size_t queuedWrites() const { return uploader.queuedWrites(); }
 
-	void append(Row input)
-	{
-		insert(append_pos, input);
-		append_pos = (append_pos + 1) % tex_height;
-	}
+	/// slider ranges for the view controls; zoom is 2^(level/100)
+	static constexpr int zoom_level_max = 600;
+	static constexpr int pan_max = 1000;
 
-	bool insert(int pos, Row input)
-	{
-		if (pos >= tex_height)
-		{
-			return false;
-		}
-		assert(input.size() == tex_width);
-		auto input_ptr = std::make_shared<Row>(std::move(input));
-
-		input_qs[0].input_q.enqueue(UploadQueue::Entry{append_pos, input_ptr});
-		input_qs[1].input_q.enqueue(UploadQueue::Entry{append_pos, input_ptr});
-		return true;
-	}
+	/// Next row of the matrix, wrapping around at the end
+	void append(Row input) { uploader.append(std::move(input)); }
+
+	/// Overwrite row pos of the matrix
+	bool insert(int pos, Row input) { return uploader.insert(pos, std::move(input)); }
+
+	/// Overwrite the columns [col_begin, col_begin + band.size()) of row pos
+	bool update_band(int pos, int col_begin, Row band) { return uploader.update_band(pos, col_begin, std::move(band)); }
+
+	/// Like append() and insert(), for rows already in sparse form
+	void append_sparse(SparseRow input) { uploader.append_sparse(std::move(input)); }
+	bool insert_sparse(int pos, SparseRow input) { return uploader.insert_sparse(pos, std::move(input)); }
+
+	/// Next n columns, rowCount() values each, one column after the other; see MatrixUploader::append_columns()
+	void append_columns(const T* columns, int n) { uploader.append_columns(columns, n); }
+
+	/// Queues for a further producer thread, see MatrixUploader::Producer
+	Producer add_producer(int row_begin, int row_end) { return uploader.add_producer(row_begin, row_end); }
+
+	/// Tee every inserted row to a recorder; set before rows are inserted
+	void set_recorder(std::shared_ptr<RowRecorder> r) { uploader.set_recorder(std::move(r)); }
+
+	/// Set before rows are inserted; with DrainToShadow, the queues are drained while the widget isn't painted
+	void set_ingest_policy(MatrixUploader::IngestPolicy policy);
+	/// Set before the widget is shown; Auto calibrates on the first context
+	void set_upload_strategy(MatrixUploader::UploadStrategy strategy) { uploader.set_upload_strategy(strategy); }
+	/// Set before rows are inserted, see MatrixUploader::set_sparse_fill()
+	void set_sparse_fill(float max_fill) { uploader.set_sparse_fill(max_fill); }
 
 public slots:
 	void issue_redraw() { update(); };
-	void set_is_radarplot(int state) { is_radar_plot = state != 0; }
+	void set_is_radarplot(int state) { is_radar_plot = state != 0; update(); }
+	void set_auto_contrast(int state);
+	/// Transfer function by index, see Transfer
+	void set_transfer(int index);
+	/// Reference power for Decibel, exponent for Gamma
+	void set_transfer_param(double param);
+	/// dB shown from black to the top of the colour map while auto contrast is off
+	void set_db_range(double floor, double ceiling);
+	/// Interpolation by index, see Interpolation
+	void set_interpolation(int index);
+	/// Take the statistics from a reduction of the texture on the GPU instead of the producers
+	void set_gpu_stats(int state);
+	/// ComplexView by index, for complex samples
+	void set_complex_view(int index);
+
+	void set_zoom(int level);
+	void set_row_pan(int pos);
+	void set_column_pan(int pos);
+	void reset_view();
 
 	void cleanup();
 	static void openGLErrorRecieved(const QOpenGLDebugMessage& debugMessage);
 
+signals:
+	void zoom_changed(int level);
+	void row_pan_changed(int pos);
+	void column_pan_changed(int pos);
+
 protected:
 	void initializeGL() override;
 	void paintGL() override;
 	void resizeGL(int width, int height) override;
 	void mousePressEvent(QMouseEvent* event) override;
 	void mouseMoveEvent(QMouseEvent* event) override;
-
-	void initBuffers();
-	void initTexture();
+	void mouseDoubleClickEvent(QMouseEvent* event) override;
+	void wheelEvent(QWheelEvent* event) override;
 
 private:
-	void copy_frontbuffer_to_texture();
-	void process_upload_queue();
-	bool upload_to_pbo(GLuint pbo_id, int start_row_idx, const std::vector<RowPtr>& data);
-
-	int tex_width;
-	int tex_height;
+	void set_view(float zoom, float center_s, float center_t);
+	void update_lod();
+	void update_contrast();
+	/// Drains the queues into the shadow matrix if no frame was painted for stall_ms
+	void drain_if_stalled();
+	/// The program for the current modes, built on first use
+	QOpenGLShaderProgram* shader_variant();
+	QSizeF cellSize() const;
+	/* With auto contrast, the statistics are reduced on the GPU when asked
+	 * for, and always for complex samples: the producers only see I and Q,
+	 * not what is displayed. Without, nothing uses them.
+	 */
+	bool stats_on_gpu() const { return auto_contrast && !reduction_failed && (gpu_stats || componentCount() > 1); }
+	/// Once stats_on_gpu() turned false, or the reduction computes an outdated view
+	void destroy_reduction();
+	/// Producer side statistics, per auto contrast and stats_on_gpu()
+	void update_stats_source();
+
+	MatrixUploader uploader;
+	UploadContext* upload_context; ///< shared background uploads, nullptr to upload in paintGL()
 
 	QOpenGLVertexArrayObject m_vao;
-	std::unique_ptr<QOpenGLShaderProgram> m_program;
-
-	GLuint textureId; // ID of texture
-
-	GLuint upload_idx;
-	GLuint copy_idx;
+	/* Each combination of display modes gets a program specialized by
+	 * #defines, so the fragment shader doesn't branch on uniforms. Programs
+	 * are keyed by the mode bits and kept for the lifetime of the context.
+	 */
+	QByteArray frag_source; ///< frag.glsl as read, before adding the defines
+	std::map<int, std::unique_ptr<QOpenGLShaderProgram>> programs;
+	QOpenGLShaderProgram* m_program; ///< variant of the current frame
 
 	std::unique_ptr<QOpenGLDebugLogger> logger;
 
-	QTime timer;
 	QTime fps;
-
-	double upload_time;
-	double copy_time;
 	long time_cnt;
 
+	/// Context (re-)creation until the first frame drawn from the restored matrix
+	QElapsedTimer since_init;
+	bool first_frame_pending;
+	int n_contexts;
+
+	static constexpr int stall_ms = 200;
+	QTimer drain_timer;
+	QElapsedTimer since_paint;
+
 	bool is_radar_plot;
 
-	struct UploadQueue
+	/* View transform in texture coordinates: s runs along the columns (screen
+	 * vertical), t along the rows (screen horizontal). The visible window is
+	 * [center - 0.5/zoom, center + 0.5/zoom] on both axes.
+	 */
+	float view_zoom;
+	float view_center_s;
+	float view_center_t;
+	QPoint last_mouse_pos;
+
+	int lod; ///< mip level wanted for the current view, 0 if zoomed in
+
+	/// Auto contrast maps these quantiles of the recent intensities to 0 and 1
+	static constexpr float contrast_low_quantile = 0.01f;
+	static constexpr float contrast_high_quantile = 0.99f;
+	Transfer transfer;
+	float transfer_param;
+	float db_floor;
+	float db_ceiling;
+	/// The log magnitude of complex samples is in dB already, no transfer is applied on top of it
+	Transfer appliedTransfer() const
 	{
-		struct Entry
-		{
-			int matrix_row;
-			RowPtr values;
-		};
-		using LockFreeQueue = moodycamel::ReaderWriterQueue<Entry>;
-
-		UploadQueue(int reserved_size)
-			: pbo_id(0)
-			, input_q(reserved_size)
-		{
-		}
-
-		GLuint pbo_id;
-		LockFreeQueue input_q;
-	};
+		return (componentCount() > 1 && complex_view == ComplexView::LogMagnitude) ? Transfer::Linear : transfer;
+	}
+	/// The shader's values before contrast are in dB: the Decibel transfer, or the log magnitude of complex samples
+	bool showsDecibels() const
+	{
+		return transfer == Transfer::Decibel || (componentCount() > 1 && complex_view == ComplexView::LogMagnitude);
+	}
+
+	Interpolation interpolation;
+	ComplexView complex_view;
+	GLuint sampler; ///< filtering of the matrix texture, per the interpolation and mip levels
+
+	/// GPU time of the matrix draw, read back a frame later from alternating queries
+	std::array<GLuint, 2> draw_queries;
+	long draw_query_cnt; ///< queries issued since the context was created
+	double draw_time;
+
+	bool auto_contrast;
+	bool gpu_stats;
+	bool reduction_failed; ///< the reduction doesn't work on this context, the producers keep the statistics
+	std::unique_ptr<GpuReduction> reduction; ///< while stats_on_gpu()
+	IntensitySummary intensity;
+	float gain;   ///< shader intensity = value * gain + offset
+	float offset;
 
-	std::array<UploadQueue, 2> input_qs;
-	std::vector<T> upload_prepare_buffer;
+	/// Layers are drawn as instanced quads, grid_cols x grid_rows cells filled row by row
+	int grid_cols;
+	int grid_rows;
 
 	long n_paint;
-	int append_pos; /// last append position
 };
 
 #endif
@@ -0,0 +1,396 @@
+#include "gpureduction.h"
+
+#include <QOpenGLContext>
+#include <QOpenGLShaderProgram>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace
+{
+/// Bound for the points scattered into the histogram; larger textures are subsampled
+const int max_histogram_points = 1 << 20;
+
+/// Full screen triangle, as in the widget
+const char* fullscreenVertexSource = "void main()\n"
+									 "{\n"
+									 "    float x = -1.0 + float((gl_VertexID & 1) << 2);\n"
+									 "    float y = -1.0 + float((gl_VertexID & 2) << 1);\n"
+									 "    gl_Position = vec4(x, y, 0, 1);\n"
+									 "}";
+
+/// Shared by all passes: fetch(p, l) as vec4(min, max, sum, count); VALUE() as in frag.glsl
+const char* fetchSource = "uniform ivec2 size;\n"
+						  "#ifndef VALUE\n"
+						  "#define VALUE(t) (t).x\n"
+						  "#endif\n"
+						  "#ifdef LAYERED\n"
+						  "uniform highp sampler2DArray tex;\n"
+						  "uniform int layers;\n"
+						  "vec4 fetch(ivec2 p, int l) { float v = VALUE(texelFetch(tex, ivec3(p, l), 0)); return vec4(v, v, v, 1.0); }\n"
+						  "#else\n"
+						  "uniform highp sampler2D tex;\n"
+						  "const int layers = 1;\n"
+						  "#ifdef FIRST\n"
+						  "vec4 fetch(ivec2 p, int l) { float v = VALUE(texelFetch(tex, p, 0)); return vec4(v, v, v, 1.0); }\n"
+						  "#else\n"
+						  "vec4 fetch(ivec2 p, int l) { return texelFetch(tex, p, 0); }\n"
+						  "#endif\n"
+						  "#endif\n";
+
+/// One output texel combines 4x4 input texels of all layers
+const char* reduceSource = "out highp vec4 result;\n"
+						   "void main()\n"
+						   "{\n"
+						   "    ivec2 base = ivec2(gl_FragCoord.xy) * 4;\n"
+						   "    highp vec4 r = vec4(3.4e38, -3.4e38, 0.0, 0.0);\n"
+						   "    for (int l = 0; l < layers; ++l)\n"
+						   "        for (int j = 0; j < 4; ++j)\n"
+						   "            for (int i = 0; i < 4; ++i)\n"
+						   "            {\n"
+						   "                ivec2 p = base + ivec2(i, j);\n"
+						   "                if (p.x < size.x && p.y < size.y)\n"
+						   "                {\n"
+						   "                    highp vec4 v = fetch(p, l);\n"
+						   "                    r = vec4(min(r.x, v.x), max(r.y, v.y), r.z + v.z, r.w + v.w);\n"
+						   "                }\n"
+						   "            }\n"
+						   "    result = r;\n"
+						   "}";
+
+/// A point per sampled texel, placed on the pixel of its bin
+const char* histogramVertexSource = "uniform int step;\n"
+									"uniform vec2 range; // lo, bins / (hi - lo)\n"
+									"void main()\n"
+									"{\n"
+									"    ivec2 grid = (size + step - 1) / step;\n"
+									"    int cell = gl_VertexID % (grid.x * grid.y);\n"
+									"    ivec2 p = ivec2(cell % grid.x, cell / grid.x) * step;\n"
+									"    float v = fetch(p, gl_VertexID / (grid.x * grid.y)).x;\n"
+									"    float bin = clamp(floor((v - range.x) * range.y), 0.0, 255.0);\n"
+									"    gl_Position = vec4((bin + 0.5) / 128.0 - 1.0, 0.0, 0.0, 1.0);\n"
+									"}";
+
+const char* histogramFragmentSource = "out highp float count;\n"
+									  "void main() { count = 1.0; }";
+
+QByteArray shader_source(const char* defines, const char* common, const char* body)
+{
+	QByteArray source("#version 330\n");
+	source += defines;
+	source += common;
+	source += body;
+	return source;
+}
+} // namespace
+
+GpuReduction::GpuReduction()
+	: cols(0)
+	, rows(0)
+	, layers(1)
+	, histogram{0, 0, histogram_bins, 1}
+	, readback_pbo(0)
+	, readback_fence(nullptr)
+	, timer_query(0)
+	, in_flight(false)
+	, frames_in_flight(0)
+	, hist_lo(0.f)
+	, hist_hi(1.f)
+	, hist{}
+	, result_lo(0.f)
+	, result_hi(1.f)
+	, dispatch_time(0.0)
+	, gpu_time(0.0)
+	, latency_frames(0)
+{
+}
+
+GpuReduction::~GpuReduction() = default;
+
+bool GpuReduction::initialize(int cols, int rows, int layers, const char* value)
+{
+	initializeOpenGLFunctions();
+	this->cols = cols;
+	this->rows = rows;
+	this->layers = layers;
+
+	QByteArray defines(layers > 1 ? "#define LAYERED\n" : "#define FIRST\n");
+	defines += "#define VALUE(t) ";
+	defines += value;
+	defines += "\n";
+	const char* data_defines = defines.constData();
+	first_pass = std::make_unique<QOpenGLShaderProgram>();
+	first_pass->addShaderFromSourceCode(QOpenGLShader::Vertex, shader_source("", "", fullscreenVertexSource));
+	first_pass->addShaderFromSourceCode(QOpenGLShader::Fragment, shader_source(data_defines, fetchSource, reduceSource));
+	reduce_pass = std::make_unique<QOpenGLShaderProgram>();
+	reduce_pass->addShaderFromSourceCode(QOpenGLShader::Vertex, shader_source("", "", fullscreenVertexSource));
+	reduce_pass->addShaderFromSourceCode(QOpenGLShader::Fragment, shader_source("", fetchSource, reduceSource));
+	histogram_pass = std::make_unique<QOpenGLShaderProgram>();
+	histogram_pass->addShaderFromSourceCode(
+			QOpenGLShader::Vertex, shader_source(data_defines, fetchSource, histogramVertexSource));
+	histogram_pass->addShaderFromSourceCode(
+			QOpenGLShader::Fragment, shader_source("", "", histogramFragmentSource));
+	if (!first_pass->link() || !reduce_pass->link() || !histogram_pass->link())
+	{
+		std::cerr << "GPU statistics: cannot link the reduction shaders\n";
+		destroy();
+		return false;
+	}
+	vao.create();
+
+	auto make_target = [this](Level& level, GLenum internal_format, GLenum format) {
+		glGenTextures(1, &level.texture);
+		glBindTexture(GL_TEXTURE_2D, level.texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexImage2D(GL_TEXTURE_2D, 0, internal_format, level.width, level.height, 0, format, GL_FLOAT, nullptr);
+		glGenFramebuffers(1, &level.fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, level.fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, level.texture, 0);
+		return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	};
+
+	bool ok = true;
+	int w = cols;
+	int h = rows;
+	do
+	{
+		w = (w + 3) / 4;
+		h = (h + 3) / 4;
+		levels.push_back(Level{0, 0, w, h});
+		ok = make_target(levels.back(), GL_RGBA32F, GL_RGBA) && ok;
+	} while (w > 1 || h > 1);
+	ok = make_target(histogram, GL_R32F, GL_RED) && ok;
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (!ok)
+	{
+		std::cerr << "GPU statistics: float render targets are not supported\n";
+		destroy();
+		return false;
+	}
+
+	glGenBuffers(1, &readback_pbo);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback_pbo);
+	glBufferData(GL_PIXEL_PACK_BUFFER, (4 + histogram_bins) * sizeof(GLfloat), nullptr, GL_STREAM_READ);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+#ifdef GL_TIME_ELAPSED
+	if (!QOpenGLContext::currentContext()->isOpenGLES())
+	{
+		glGenQueries(1, &timer_query);
+	}
+#endif
+	return true;
+}
+
+void GpuReduction::destroy()
+{
+	for (Level& level : levels)
+	{
+		glDeleteFramebuffers(1, &level.fbo);
+		glDeleteTextures(1, &level.texture);
+	}
+	levels.clear();
+	if (histogram.fbo)
+	{
+		glDeleteFramebuffers(1, &histogram.fbo);
+		glDeleteTextures(1, &histogram.texture);
+		histogram.fbo = 0;
+		histogram.texture = 0;
+	}
+	if (readback_pbo)
+	{
+		glDeleteBuffers(1, &readback_pbo);
+		readback_pbo = 0;
+	}
+	if (readback_fence)
+	{
+		glDeleteSync(readback_fence);
+		readback_fence = nullptr;
+	}
+	if (timer_query)
+	{
+		glDeleteQueries(1, &timer_query);
+		timer_query = 0;
+	}
+	vao.destroy();
+	first_pass.reset();
+	reduce_pass.reset();
+	histogram_pass.reset();
+	in_flight = false;
+}
+
+void GpuReduction::run(GLuint texture, GLuint fbo, int viewport_width, int viewport_height)
+{
+	if (levels.empty())
+		return;
+	if (in_flight && !poll())
+		return; // the previous reduction isn't back yet, don't queue up another
+
+	timer.start();
+	if (timer_query)
+	{
+#ifdef GL_TIME_ELAPSED
+		glBeginQuery(GL_TIME_ELAPSED, timer_query);
+#endif
+	}
+
+	const GLenum target = layers > 1 ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+	const bool depth_test = glIsEnabled(GL_DEPTH_TEST);
+	const bool cull_face = glIsEnabled(GL_CULL_FACE);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+	QOpenGLVertexArrayObject::Binder vaoBinder(&vao);
+	glActiveTexture(GL_TEXTURE0);
+
+	// min, max, sum, count: the data texture, then ping-pong down to one texel
+	QOpenGLShaderProgram* program = first_pass.get();
+	GLenum input_target = target;
+	GLuint input = texture;
+	int input_width = cols;
+	int input_height = rows;
+	for (const Level& level : levels)
+	{
+		program->bind();
+		program->setUniformValue("tex", 0);
+		program->setUniformValue("size", input_width, input_height);
+		program->setUniformValue("layers", layers);
+		glBindTexture(input_target, input);
+		glBindFramebuffer(GL_FRAMEBUFFER, level.fbo);
+		glViewport(0, 0, level.width, level.height);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		glBindTexture(input_target, 0);
+
+		program = reduce_pass.get();
+		input_target = GL_TEXTURE_2D;
+		input = level.texture;
+		input_width = level.width;
+		input_height = level.height;
+	}
+
+	// histogram over the range of the previous result
+	hist_lo = stats.valid ? stats.min : 0.f;
+	hist_hi = stats.valid && stats.max > stats.min ? stats.max : hist_lo + 1.f;
+	const double texels = double(cols) * rows * layers;
+	const int step = std::max(1, int(std::ceil(std::sqrt(texels / max_histogram_points))));
+	const int n_points = ((cols + step - 1) / step) * ((rows + step - 1) / step) * layers;
+
+	const GLfloat zero[4] = {0.f, 0.f, 0.f, 0.f};
+	glBindFramebuffer(GL_FRAMEBUFFER, histogram.fbo);
+	glViewport(0, 0, histogram.width, histogram.height);
+	glClearBufferfv(GL_COLOR, 0, zero);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+	histogram_pass->bind();
+	histogram_pass->setUniformValue("tex", 0);
+	histogram_pass->setUniformValue("size", cols, rows);
+	histogram_pass->setUniformValue("layers", layers);
+	histogram_pass->setUniformValue("step", step);
+	histogram_pass->setUniformValue("range", hist_lo, histogram_bins / (hist_hi - hist_lo));
+	glBindTexture(target, texture);
+	glDrawArrays(GL_POINTS, 0, n_points);
+	glBindTexture(target, 0);
+	glDisable(GL_BLEND);
+	histogram_pass->release();
+
+	// into the PBO; mapped once the fence signals, on a later frame
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback_pbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, levels.back().fbo);
+	glReadPixels(0, 0, 1, 1, GL_RGBA, GL_FLOAT, nullptr);
+	glBindFramebuffer(GL_FRAMEBUFFER, histogram.fbo);
+	glReadPixels(0, 0, histogram_bins, 1, GL_RED, GL_FLOAT, reinterpret_cast<void*>(4 * sizeof(GLfloat)));
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	if (timer_query)
+	{
+#ifdef GL_TIME_ELAPSED
+		glEndQuery(GL_TIME_ELAPSED);
+#endif
+	}
+	readback_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	in_flight = true;
+	frames_in_flight = 0;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glViewport(0, 0, viewport_width, viewport_height);
+	if (depth_test)
+		glEnable(GL_DEPTH_TEST);
+	if (cull_face)
+		glEnable(GL_CULL_FACE);
+
+	const double elapsed = timer.nsecsElapsed() * 1e-9;
+	dispatch_time = dispatch_time > 0 ? 0.9 * dispatch_time + 0.1 * elapsed : elapsed;
+}
+
+bool GpuReduction::poll()
+{
+	++frames_in_flight;
+	const GLenum state = glClientWaitSync(readback_fence, 0, 0);
+	if (state != GL_ALREADY_SIGNALED && state != GL_CONDITION_SATISFIED)
+		return false;
+	glDeleteSync(readback_fence);
+	readback_fence = nullptr;
+	in_flight = false;
+	latency_frames = frames_in_flight;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback_pbo);
+	auto* data = static_cast<const GLfloat*>(
+			glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (4 + histogram_bins) * sizeof(GLfloat), GL_MAP_READ_BIT));
+	if (data)
+	{
+		if (data[3] > 0)
+		{
+			stats.valid = true;
+			stats.min = data[0];
+			stats.max = data[1];
+			stats.mean = data[2] / data[3];
+		}
+		std::copy(data + 4, data + 4 + histogram_bins, hist.begin());
+		result_lo = hist_lo;
+		result_hi = hist_hi;
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	if (timer_query)
+	{
+		// the fence passed, so the query result is available without waiting
+		GLuint ns = 0;
+		glGetQueryObjectuiv(timer_query, GL_QUERY_RESULT, &ns);
+		gpu_time = gpu_time > 0 ? 0.9 * gpu_time + 0.1 * ns * 1e-9 : ns * 1e-9;
+	}
+	return true;
+}
+
+IntensitySummary GpuReduction::summary(float low_q, float high_q) const
+{
+	IntensitySummary s = stats;
+	if (!s.valid)
+		return s;
+
+	double total = 0;
+	for (float c : hist)
+	{
+		total += c;
+	}
+	const float w = (result_hi - result_lo) / histogram_bins;
+	auto quantile = [&](float q) {
+		const double target = q * total;
+		double cum = 0;
+		for (int i = 0; i < histogram_bins; ++i)
+		{
+			if (hist[i] > 0 && cum + hist[i] >= target)
+			{
+				const float v = result_lo + (i + float((target - cum) / hist[i])) * w;
+				return std::min(std::max(v, s.min), s.max);
+			}
+			cum += hist[i];
+		}
+		return s.max;
+	};
+	s.low = quantile(low_q);
+	s.high = quantile(high_q);
+	return s;
+}
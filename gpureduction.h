@@ -0,0 +1,100 @@
+#ifndef GPUREDUCTION_H
+#define GPUREDUCTION_H
+
+#include <QElapsedTimer>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLVertexArrayObject>
+
+#include <array>
+#include <memory>
+#include <vector>
+
+#include "intensitystats.h"
+
+QT_FORWARD_DECLARE_CLASS(QOpenGLShaderProgram)
+
+/* Intensity statistics computed on the GPU, from the displayed texture.
+ *
+ * run() reduces the texture to min, max, sum and count in fragment shader
+ * passes of 4x4 texels each (ping-ponging down to a single texel), and
+ * scatters the texels as points into a 256 bin histogram with additive
+ * blending. The histogram spans the min..max of the previous result. Both
+ * are read back into a PBO behind a fence, which is polled on the following
+ * frames, so the GUI thread never waits for the GPU; while a readback is
+ * outstanding, no new reduction is started.
+ */
+class GpuReduction : protected QOpenGLExtraFunctions
+{
+public:
+	static constexpr int histogram_bins = 256;
+
+	GpuReduction();
+	~GpuReduction();
+
+	/* With the context current; the data texture has cols x rows texels and
+	 * layers layers. value is the GLSL expression of the value of a texel t.
+	 */
+	bool initialize(int cols, int rows, int layers, const char* value = "(t).x");
+	void destroy();
+
+	/// Starts a reduction of the texture unless one is in flight; leaves framebuffer fbo bound
+	void run(GLuint texture, GLuint fbo, int viewport_width, int viewport_height);
+
+	/// Latest statistics read back, with the quantiles low_q and high_q from the histogram
+	IntensitySummary summary(float low_q, float high_q) const;
+
+	/// Smoothed CPU time to issue a reduction in s
+	double dispatchTime() const { return dispatch_time; }
+	/// Smoothed GPU time of a reduction in s, 0 if timer queries are unavailable
+	double gpuTime() const { return gpu_time; }
+	/// Frames between issuing a reduction and reading it back
+	int latency() const { return latency_frames; }
+
+private:
+	GpuReduction(const GpuReduction&) = delete;
+	GpuReduction& operator=(const GpuReduction&) = delete;
+
+	/// Reads back a finished reduction; false if none is or the GPU isn't done
+	bool poll();
+
+	struct Level
+	{
+		GLuint texture;
+		GLuint fbo;
+		int width;
+		int height;
+	};
+
+	int cols;
+	int rows;
+	int layers;
+
+	std::unique_ptr<QOpenGLShaderProgram> first_pass;  ///< data texture to min, max, sum, count
+	std::unique_ptr<QOpenGLShaderProgram> reduce_pass; ///< 4x4 of those to one
+	std::unique_ptr<QOpenGLShaderProgram> histogram_pass;
+	QOpenGLVertexArrayObject vao;
+
+	std::vector<Level> levels; ///< down to 1x1
+	Level histogram;
+	GLuint readback_pbo;
+	GLsync readback_fence;
+	GLuint timer_query; ///< 0 without timer queries (OpenGL ES)
+
+	bool in_flight;
+	int frames_in_flight;
+	float hist_lo; ///< histogram range of the reduction in flight
+	float hist_hi;
+
+	/// last result read back
+	IntensitySummary stats;
+	std::array<float, histogram_bins> hist;
+	float result_lo;
+	float result_hi;
+
+	QElapsedTimer timer;
+	double dispatch_time;
+	double gpu_time;
+	int latency_frames;
+};
+
+#endif
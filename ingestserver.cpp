@@ -0,0 +1,195 @@
+#include "ingestserver.h"
+#include "glwidget.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <cerrno>
+#include <chrono>
+#include <iostream>
+
+IngestServer::IngestServer(GLWidget* widget, size_t cols)
+	: w(widget)
+	, cols(cols)
+	, listen_fd(-1)
+	, stop(false)
+	, n_count(0)
+{
+}
+
+IngestServer::~IngestServer()
+{
+	stop.store(true);
+	if (reader.joinable())
+	{
+		reader.join();
+	}
+	for (auto& c : clients)
+	{
+		::close(c.fd);
+	}
+	if (listen_fd >= 0)
+	{
+		::close(listen_fd);
+		unlink(socket_path.c_str());
+	}
+}
+
+bool IngestServer::listen_shm(const std::string& name, size_t slot_count)
+{
+	ring = ShmRowRing::create(name, cols, slot_count);
+	if (ring)
+	{
+		std::cerr << "Ingest: shared memory ring " << name << " with " << slot_count << " rows of " << cols << "\n";
+	}
+	return ring != nullptr;
+}
+
+bool IngestServer::listen_socket(const std::string& path)
+{
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path))
+	{
+		std::cerr << "Ingest: socket path too long\n";
+		return false;
+	}
+	memcpy(addr.sun_path, path.c_str(), path.size());
+
+	listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listen_fd < 0)
+	{
+		std::cerr << "Ingest: cannot create socket\n";
+		return false;
+	}
+	unlink(path.c_str());
+	if (bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listen_fd, 4) != 0)
+	{
+		std::cerr << "Ingest: cannot listen on " << path << "\n";
+		::close(listen_fd);
+		listen_fd = -1;
+		return false;
+	}
+	socket_path = path;
+	std::cerr << "Ingest: listening on " << path << "\n";
+	return true;
+}
+
+void IngestServer::start() { reader = std::thread([this] { run(); }); }
+
+void IngestServer::run()
+{
+	using namespace std::chrono;
+
+	std::vector<pollfd> fds;
+	auto report_start = steady_clock::now();
+	while (!stop.load())
+	{
+		if (n_count >= 10000)
+		{
+			auto now = steady_clock::now();
+			std::cerr << "Ingest DPS: " << n_count / duration<double>(now - report_start).count() << "\n";
+			n_count = 0;
+			report_start = now;
+		}
+
+		const size_t from_ring = drain_ring();
+
+		fds.clear();
+		if (listen_fd >= 0)
+			fds.push_back(pollfd{listen_fd, POLLIN, 0});
+		for (auto& c : clients)
+			fds.push_back(pollfd{c.fd, POLLIN, 0});
+
+		/* The ring can't be polled; bound the latency for it with the timeout.
+		 * While it delivers rows, the sockets are only checked, so a busy ring
+		 * neither waits for them nor keeps them out after a capped drain.
+		 */
+		const int timeout_ms = from_ring > 0 ? 0 : ring ? 1 : 100;
+		if (fds.empty())
+		{
+			if (from_ring == 0)
+				std::this_thread::sleep_for(milliseconds(timeout_ms));
+			continue;
+		}
+		if (poll(fds.data(), fds.size(), timeout_ms) <= 0)
+			continue;
+
+		size_t i = 0;
+		if (listen_fd >= 0 && (fds[i++].revents & POLLIN))
+		{
+			accept_client();
+		}
+		for (auto it = clients.begin(); it != clients.end() && i < fds.size(); ++i)
+		{
+			if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) && !read_client(*it))
+			{
+				::close(it->fd);
+				it = clients.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+	}
+}
+
+size_t IngestServer::drain_ring()
+{
+	if (!ring)
+		return 0;
+
+	size_t n = 0;
+	while (const float* src = ring->begin_read())
+	{
+		w->append(GLWidget::Row(src, src + cols));
+		ring->end_read();
+
+		// let the socket clients in once in a while
+		if (++n == 4096)
+			break;
+	}
+	n_count += n;
+	return n;
+}
+
+void IngestServer::accept_client()
+{
+	int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	const uint64_t row_len = cols;
+	if (send(fd, &row_len, sizeof(row_len), MSG_NOSIGNAL) != ssize_t(sizeof(row_len)))
+	{
+		::close(fd);
+		return;
+	}
+	clients.push_back(Client{fd, std::vector<char>(rows_per_recv * cols * sizeof(float)), 0});
+}
+
+bool IngestServer::read_client(Client& c)
+{
+	// receive many rows per syscall; a partial row stays at the front of the buffer
+	ssize_t n = recv(c.fd, c.buffer.data() + c.fill, c.buffer.size() - c.fill, 0);
+	if (n == 0)
+		return false; // disconnected
+	if (n < 0)
+		return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+	c.fill += n;
+
+	const size_t row_bytes = cols * sizeof(float);
+	size_t done = 0;
+	for (; c.fill - done >= row_bytes; done += row_bytes)
+	{
+		const float* src = reinterpret_cast<const float*>(c.buffer.data() + done);
+		w->append(GLWidget::Row(src, src + cols));
+		++n_count;
+	}
+	memmove(c.buffer.data(), c.buffer.data() + done, c.fill - done);
+	c.fill -= done;
+	return true;
+}
@@ -0,0 +1,66 @@
+#ifndef INGESTSERVER_H
+#define INGESTSERVER_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "shmring.h"
+
+class GLWidget;
+
+/* Ingest endpoint for producers running in another process.
+ *
+ * - Shared memory: a ShmRowRing created under the given name; the fast path
+ *   without per-row syscalls.
+ * - Unix domain socket fallback: on connect, the server sends the row length
+ *   as uint64_t, then the client streams raw float32 rows of that length.
+ *
+ * A single reader thread services both, so the widget still sees exactly one
+ * producer.
+ */
+class IngestServer
+{
+public:
+	IngestServer(GLWidget* widget, size_t cols);
+	~IngestServer();
+
+	bool listen_shm(const std::string& name, size_t slot_count);
+	bool listen_socket(const std::string& path);
+
+	void start();
+
+private:
+	IngestServer(const IngestServer&) = delete;
+	IngestServer& operator=(const IngestServer&) = delete;
+
+	static constexpr size_t rows_per_recv = 64;
+
+	struct Client
+	{
+		int fd;
+		std::vector<char> buffer; ///< received bytes not yet forming a full row
+		size_t fill;
+	};
+
+	void run();
+	size_t drain_ring();
+	void accept_client();
+	bool read_client(Client& c);
+
+	GLWidget* w;
+	size_t cols;
+
+	std::unique_ptr<ShmRowRing> ring;
+	int listen_fd;
+	std::string socket_path;
+	std::vector<Client> clients;
+
+	std::atomic<bool> stop;
+	std::thread reader;
+	long n_count;
+};
+
+#endif
@@ -0,0 +1,198 @@
+#include "intensitystats.h"
+
+#include <algorithm>
+
+int IntensitySketch::bin_of(float v) const
+{
+	const int b = int((v - lo) * (bins / (hi - lo)));
+	return b < 0 ? 0 : (b >= bins ? bins - 1 : b);
+}
+
+void IntensitySketch::add(const float* values, size_t n)
+{
+	if (n == 0)
+		return;
+
+	// range and sum in one pass, written so the compiler can vectorize it
+	float row_min = values[0];
+	float row_max = values[0];
+	float row_sum = 0.f;
+	for (size_t i = 0; i < n; ++i)
+	{
+		const float v = values[i];
+		row_min = v < row_min ? v : row_min;
+		row_max = v > row_max ? v : row_max;
+		row_sum += v;
+	}
+
+	include(row_min, row_max);
+
+	const float scale = bins / (hi - lo);
+	for (size_t i = 0; i < n; ++i)
+	{
+		const int b = int((values[i] - lo) * scale);
+		counts[b < 0 ? 0 : (b >= bins ? bins - 1 : b)] += 1.0;
+	}
+	total += n;
+	sum += row_sum;
+
+	if (total > window)
+	{
+		decay();
+	}
+}
+
+void IntensitySketch::add_constant(float value, size_t n)
+{
+	if (n == 0)
+		return;
+
+	include(value, value);
+	counts[bin_of(value)] += double(n);
+	total += n;
+	sum += double(value) * n;
+
+	if (total > window)
+	{
+		decay();
+	}
+}
+
+void IntensitySketch::include(float row_min, float row_max)
+{
+	if (isEmpty())
+	{
+		lo = row_min;
+		hi = row_max > row_min ? row_max : row_min + 1.f;
+		min_v = row_min;
+		max_v = row_max;
+	}
+	else
+	{
+		min_v = std::min(min_v, row_min);
+		max_v = std::max(max_v, row_max);
+		if (row_min < lo || row_max > hi)
+		{
+			// grow by at least a factor of two, towards the side the data left on
+			float new_lo = std::min(lo, row_min);
+			float new_hi = std::max(hi, row_max);
+			const float extra = 2.f * (hi - lo) - (new_hi - new_lo);
+			if (extra > 0.f)
+			{
+				if (row_min < lo)
+					new_lo -= extra;
+				else
+					new_hi += extra;
+			}
+			rebin(new_lo, new_hi);
+		}
+	}
+}
+
+void IntensitySketch::rebin(float new_lo, float new_hi)
+{
+	if (!(new_hi > new_lo))
+		new_hi = new_lo + 1.f;
+
+	const float old_lo = lo;
+	const float old_w = bin_width();
+	const std::array<double, bins> old = counts;
+
+	lo = new_lo;
+	hi = new_hi;
+	counts.fill(0.0);
+	for (int i = 0; i < bins; ++i)
+	{
+		if (old[i] > 0)
+			counts[bin_of(old_lo + (i + 0.5f) * old_w)] += old[i];
+	}
+}
+
+void IntensitySketch::decay()
+{
+	int first = bins;
+	int last = -1;
+	total = 0;
+	for (int i = 0; i < bins; ++i)
+	{
+		// what drops below one value is forgotten
+		counts[i] = counts[i] >= 2.0 ? 0.5 * counts[i] : 0.0;
+		total += counts[i];
+		if (counts[i] > 0)
+		{
+			first = std::min(first, i);
+			last = i;
+		}
+	}
+	sum *= 0.5;
+	if (last < 0)
+	{
+		total = 0;
+		sum = 0;
+		return;
+	}
+
+	const float w = bin_width();
+	min_v = std::max(min_v, lo + first * w);
+	max_v = std::min(max_v, lo + (last + 1) * w);
+	if (last - first + 1 < bins / 4)
+	{
+		// the data narrowed down, regain resolution
+		rebin(lo + first * w, lo + (last + 1) * w);
+	}
+}
+
+IntensitySummary IntensitySketch::summarize(const std::vector<IntensitySketch>& sketches, float low_q, float high_q)
+{
+	IntensitySummary s;
+	IntensitySketch merged;
+	for (const IntensitySketch& sketch : sketches)
+	{
+		if (sketch.isEmpty())
+			continue;
+		if (merged.isEmpty())
+		{
+			merged = sketch;
+			continue;
+		}
+		if (sketch.lo < merged.lo || sketch.hi > merged.hi)
+			merged.rebin(std::min(merged.lo, sketch.lo), std::max(merged.hi, sketch.hi));
+		const float w = sketch.bin_width();
+		for (int i = 0; i < bins; ++i)
+		{
+			if (sketch.counts[i] > 0)
+				merged.counts[merged.bin_of(sketch.lo + (i + 0.5f) * w)] += sketch.counts[i];
+		}
+		merged.total += sketch.total;
+		merged.sum += sketch.sum;
+		merged.min_v = std::min(merged.min_v, sketch.min_v);
+		merged.max_v = std::max(merged.max_v, sketch.max_v);
+	}
+	if (merged.isEmpty())
+		return s;
+
+	auto quantile = [&merged](float q) {
+		const double target = q * merged.total;
+		const float w = merged.bin_width();
+		double cum = 0;
+		for (int i = 0; i < bins; ++i)
+		{
+			const double c = merged.counts[i];
+			if (c > 0 && cum + c >= target)
+			{
+				const float v = merged.lo + (i + float((target - cum) / c)) * w;
+				return std::min(std::max(v, merged.min_v), merged.max_v);
+			}
+			cum += c;
+		}
+		return merged.max_v;
+	};
+
+	s.valid = true;
+	s.min = merged.min_v;
+	s.max = merged.max_v;
+	s.mean = float(merged.sum / merged.total);
+	s.low = quantile(low_q);
+	s.high = quantile(high_q);
+	return s;
+}
@@ -0,0 +1,62 @@
+#ifndef INTENSITYSTATS_H
+#define INTENSITYSTATS_H
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+/// Recent intensities of a matrix, for auto contrast and the timing report
+struct IntensitySummary
+{
+	bool valid = false;
+	float min = 0.f;
+	float max = 0.f;
+	float mean = 0.f;
+	float low = 0.f;  ///< low quantile, see IntensitySketch::summarize()
+	float high = 0.f; ///< high quantile
+};
+
+/* Streaming statistics of the values of one producer.
+ *
+ * Keeps min, max, sum and a histogram with a fixed number of bins, whose
+ * range grows (by at least a factor of two, merging bins) when values fall
+ * outside of it. Once more than `window` values are counted, all counts are
+ * halved, so the sketch follows the recent data; the histogram range then
+ * shrinks to the occupied bins if they use only a small part of it.
+ * Quantiles are interpolated within a bin, which bounds their error by the
+ * bin width.
+ */
+class IntensitySketch
+{
+public:
+	static constexpr int bins = 256;
+	static constexpr double window = 1 << 22;
+
+	void add(const float* values, size_t n);
+	/// n times the same value, e.g. the background of a sparse row
+	void add_constant(float value, size_t n);
+
+	bool isEmpty() const { return total <= 0; }
+
+	/// Merges the sketches and reads the quantiles low_q and high_q off the merged histogram
+	static IntensitySummary summarize(const std::vector<IntensitySketch>& sketches, float low_q, float high_q);
+
+private:
+	float bin_width() const { return (hi - lo) / bins; }
+	int bin_of(float v) const;
+	/// Widens the histogram range to cover [row_min, row_max]
+	void include(float row_min, float row_max);
+	/// Re-bins the histogram to cover [new_lo, new_hi)
+	void rebin(float new_lo, float new_hi);
+	void decay();
+
+	float lo = 0.f;
+	float hi = 0.f;
+	std::array<double, bins> counts{};
+	double total = 0;
+	double sum = 0;
+	float min_v = 0.f;
+	float max_v = 0.f;
+};
+
+#endif
@@ -0,0 +1,197 @@
+#include "loadgenerator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+
+LoadGenerator::LoadGenerator(const std::vector<GLWidget*>& widgets, const StreamOptions& options)
+	: options(options)
+	, stop(false)
+{
+	if (options.spectrogram_hop > 0)
+	{
+		// linear power, the display's dB transfer takes the log
+		spectrogram.reset(new Spectrogram(options.spectrogram_hop, Spectrogram::Scale::Power));
+	}
+	const int n_widgets = widgets.size();
+	// every widget gets at least one producer
+	const int n_producers = std::max(options.producers, n_widgets);
+	for (int i = 0; i < n_producers; ++i)
+	{
+		GLWidget* w = widgets[i % n_widgets];
+		const int n_shared = n_producers / n_widgets + (i % n_widgets < n_producers % n_widgets ? 1 : 0);
+		const int band = i / n_widgets;
+		const int rows = w->rowCount();
+
+		GLWidget::Producer sink = w->add_producer(band * rows / n_shared, (band + 1) * rows / n_shared);
+		if (sink.isValid())
+		{
+			const int channel = spectrogram ? spectrogram->add_channel(sink) : -1;
+			producers.push_back(Producer{i, sink, options.gen_rate / n_shared, channel});
+		}
+	}
+}
+
+LoadGenerator::~LoadGenerator()
+{
+	stop.store(true);
+	for (auto& t : threads)
+	{
+		t.join();
+	}
+}
+
+void LoadGenerator::start()
+{
+	if (spectrogram)
+	{
+		spectrogram->start();
+	}
+	for (const auto& p : producers)
+	{
+		threads.emplace_back([this, p] { run(p); });
+	}
+}
+
+void LoadGenerator::run(const Producer& p)
+{
+	GLWidget::Producer sink = p.sink;
+	using namespace std::chrono;
+	using clock = steady_clock;
+
+	const int cols = p.sink.columnCount();
+	const int burst = std::max(1, options.gen_burst);
+	const bool paced = p.rate > 0;
+	const auto period = paced ? duration_cast<clock::duration>(duration<double>(burst / p.rate)) : clock::duration(0);
+	const auto on_time = milliseconds(options.gen_duty_on_ms);
+	const auto cycle = on_time + milliseconds(options.gen_duty_off_ms);
+	const bool duty = options.gen_duty_on_ms > 0 && options.gen_duty_off_ms > 0;
+
+	// saturated: give up on deadlines this far behind instead of bursting to catch up
+	const auto max_lag = milliseconds(100);
+
+	// the peak shape is fixed, only its position moves; no exp() per sample
+	const int half_width = 40;
+	std::vector<float> peak(2 * half_width);
+	for (int i = 0; i < 2 * half_width; ++i)
+	{
+		peak[i] = std::exp(-(i - half_width) * (i - half_width) / 100.0f);
+	}
+
+	std::default_random_engine generator(p.id);
+	std::uniform_real_distribution<float> distribution(-1.0, 1.0);
+	std::uniform_int_distribution<int> row_distribution(sink.rowBegin(), sink.rowEnd() - 1);
+	float pos = cols / 2.f;
+	const int band = std::min(options.gen_band_cols, cols);
+	int next_row = sink.rowBegin();
+	const int band_rows = sink.rowEnd() - sink.rowBegin();
+	float col_pos = band_rows / 2.f;
+	std::vector<float> columns;
+	std::vector<float> samples;
+	double tone_phase = 0.0; ///< in cycles
+	double chirp_phase = 0.0;
+	double chirp_freq = 0.0; ///< cycles per sample
+
+	const auto t0 = clock::now();
+	auto deadline = t0;
+	auto report_start = t0;
+	long n_rows = 0;
+	long n_lagged = 0;
+
+	while (!stop.load(std::memory_order_relaxed))
+	{
+		auto now = clock::now();
+		if (duty && (now - t0) % cycle >= on_time)
+		{
+			// off phase: wait for the next cycle and restart the schedule there
+			auto next_on = now + (cycle - (now - t0) % cycle);
+			std::this_thread::sleep_until(std::min(next_on, report_start + seconds(1)));
+			deadline = clock::now();
+		}
+		else
+		{
+			if (p.channel >= 0)
+			{
+				samples.resize(size_t(burst) * options.spectrogram_hop);
+				for (float& s : samples)
+				{
+					tone_phase += 0.1;
+					chirp_freq = chirp_freq < 0.5 ? chirp_freq + 1e-6 : 0.0;
+					chirp_phase += chirp_freq;
+					tone_phase -= std::floor(tone_phase);
+					chirp_phase -= std::floor(chirp_phase);
+					s = 0.5f * std::cos(6.2831853f * float(tone_phase)) + 0.25f * std::cos(6.2831853f * float(chirp_phase))
+						+ 0.01f * distribution(generator);
+				}
+				spectrogram->push(p.channel, samples.data(), samples.size());
+			}
+			else if (options.gen_columns)
+			{
+				columns.assign(size_t(burst) * band_rows, 0.0f);
+				for (int b = 0; b < burst; ++b)
+				{
+					col_pos = std::min(std::max(col_pos + 8.f * distribution(generator), 0.f), float(band_rows - 1));
+					const int left = int(col_pos) - half_width;
+					const int first = std::max(0, left);
+					const int last = std::min(band_rows, left + 2 * half_width);
+					std::copy(peak.begin() + (first - left), peak.begin() + (last - left),
+							columns.begin() + size_t(b) * band_rows + first);
+				}
+				sink.append_columns(columns.data(), burst);
+			}
+			for (int b = 0; b < burst && !options.gen_columns && p.channel < 0; ++b)
+			{
+				pos = std::min(std::max(pos + 8.f * distribution(generator), 0.f), float(cols - 1));
+				const int left = int(pos) - half_width;
+				const int first = std::max(0, left);
+				const int last = std::min(cols, left + 2 * half_width);
+
+				const int row = options.gen_random_rows ? row_distribution(generator) : next_row;
+				next_row = (next_row + 1 == sink.rowEnd()) ? sink.rowBegin() : next_row + 1;
+				if (band > 0)
+				{
+					const int band_begin = std::min(std::max(int(pos) - band / 2, 0), cols - band);
+					GLWidget::Row v(band, 0.0f);
+					for (int c = std::max(first, band_begin); c < std::min(last, band_begin + band); ++c)
+						v[c - band_begin] = peak[c - left];
+					sink.update_band(row, band_begin, std::move(v));
+				}
+				else
+				{
+					GLWidget::Row v(cols, 0.0f);
+					std::copy(peak.begin() + (first - left), peak.begin() + (last - left), v.begin() + first);
+					sink.insert(row, std::move(v));
+				}
+			}
+			n_rows += burst;
+
+			if (paced)
+			{
+				deadline += period;
+				now = clock::now();
+				if (now - deadline > max_lag)
+				{
+					n_lagged += (now - deadline) / period;
+					deadline = now;
+				}
+				std::this_thread::sleep_until(deadline);
+			}
+		}
+
+		now = clock::now();
+		if (now - report_start >= seconds(1))
+		{
+			const double s = duration<double>(now - report_start).count();
+			const double target = paced ? p.rate * (duty ? duration<double>(on_time) / duration<double>(cycle) : 1.0) : 0.0;
+			std::cerr << "Producer " << p.id << ": " << n_rows / s << (options.gen_columns ? " columns/s" : " rows/s");
+			if (paced)
+				std::cerr << " of " << target << " target, " << n_lagged << " bursts behind schedule";
+			std::cerr << "\n";
+			report_start = now;
+			n_rows = 0;
+			n_lagged = 0;
+		}
+	}
+}
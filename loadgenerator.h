@@ -0,0 +1,64 @@
+#ifndef LOADGENERATOR_H
+#define LOADGENERATOR_H
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "glwidget.h"
+#include "spectrogram.h"
+#include "streamoptions.h"
+
+/* Synthetic rows at a controlled rate, for stressing the pipeline.
+ *
+ * Producers are spread round-robin over the widgets, at least one per
+ * widget; the producers of a widget split its rows into bands and its
+ * target rate between them. Each producer paces itself to absolute
+ * deadlines, emitting `burst` rows back to back per deadline and
+ * optionally only during the "on" part of an on/off duty cycle. Achieved vs.
+ * target rate is reported per producer every second.
+ *
+ * With random rows, each row overwrites a uniformly chosen row of the band
+ * instead; comparing the widgets' upload times of both patterns shows the
+ * cost of scattered updates. With a band width set, only that many columns
+ * around the peak are updated per row. With columns, each deadline appends
+ * `burst` columns across the producer's rows, with the peak moving along
+ * them, in one append_columns() call.
+ *
+ * With a spectrogram hop set, producers instead generate `hop` time domain
+ * samples per row (a fixed tone, a sweeping chirp and noise) and push them
+ * to a Spectrogram channel feeding their band, which emits the rows as
+ * linear power.
+ */
+class LoadGenerator
+{
+public:
+	LoadGenerator(const std::vector<GLWidget*>& widgets, const StreamOptions& options);
+	~LoadGenerator();
+
+	void start();
+
+private:
+	LoadGenerator(const LoadGenerator&) = delete;
+	LoadGenerator& operator=(const LoadGenerator&) = delete;
+
+	struct Producer
+	{
+		int id;
+		GLWidget::Producer sink;
+		double rate; ///< rows/s while on, 0 = unpaced
+		int channel; ///< of the spectrogram, -1 without
+	};
+
+	void run(const Producer& p);
+
+	std::vector<Producer> producers;
+	StreamOptions options;
+	std::unique_ptr<Spectrogram> spectrogram;
+
+	std::atomic<bool> stop;
+	std::vector<std::thread> threads;
+};
+
+#endif
@@ -0,0 +1,138 @@
+/* Per-element vs. bulk dequeue of the ingest queues.
+ *
+ * Fills a queue with entries shaped like MatrixUploader's (a row index and a
+ * shared row) and drains it into a vector the way drain_queues() does, once
+ * with try_dequeue() per entry and once with try_dequeue_bulk(). Then checks
+ * bulk and span dequeues against a concurrent producer for order and
+ * completeness.
+ *
+ * Usage: bulk_dequeue_bench [entries per drain] [rounds]
+ */
+#include <lockfree_q/readerwriterqueue.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace
+{
+struct Entry
+{
+	int matrix_row;
+	int col_begin;
+	std::shared_ptr<std::vector<float>> values;
+};
+
+using Queue = moodycamel::ReaderWriterQueue<Entry>;
+
+void fill(Queue& q, size_t n, const std::shared_ptr<std::vector<float>>& row)
+{
+	for (size_t i = 0; i < n; ++i)
+	{
+		q.enqueue(Entry{int(i), 0, row});
+	}
+}
+
+/// Seconds per drain of n entries, per element or in bulk
+double time_drain(size_t n, int rounds, bool bulk)
+{
+	using clock = std::chrono::steady_clock;
+	auto row = std::make_shared<std::vector<float>>(2000);
+	Queue q(n);
+	std::vector<Entry> out;
+	out.reserve(n);
+	clock::duration total(0);
+	for (int r = 0; r < rounds; ++r)
+	{
+		fill(q, n, row);
+		const auto t0 = clock::now();
+		if (bulk)
+		{
+			q.try_dequeue_bulk(std::back_inserter(out), std::numeric_limits<size_t>::max());
+		}
+		else
+		{
+			Entry e;
+			while (q.try_dequeue(e))
+			{
+				out.push_back(std::move(e));
+			}
+		}
+		total += clock::now() - t0;
+		if (out.size() != n)
+		{
+			std::fprintf(stderr, "Drained %zu of %zu entries\n", out.size(), n);
+			std::exit(1);
+		}
+		out.clear();
+	}
+	return std::chrono::duration<double>(total).count() / rounds;
+}
+
+/// A producer thread enqueues count values in order while the consumer takes them in bulk or in spans
+bool check_concurrent(size_t count, bool spans)
+{
+	moodycamel::ReaderWriterQueue<size_t> q(1024);
+	std::thread producer([&q, count] {
+		for (size_t i = 0; i < count; ++i)
+		{
+			while (!q.try_enqueue(i))
+			{
+			}
+		}
+	});
+
+	size_t expected = 0;
+	bool ok = true;
+	std::vector<size_t> out;
+	while (expected < count && ok)
+	{
+		if (spans)
+		{
+			size_t n = 0;
+			if (const size_t* span = q.peek_span(n))
+			{
+				for (size_t i = 0; i < n; ++i)
+					ok = ok && span[i] == expected++;
+				q.pop_span(n);
+			}
+		}
+		else
+		{
+			out.clear();
+			q.try_dequeue_bulk(std::back_inserter(out), 256);
+			for (size_t v : out)
+				ok = ok && v == expected++;
+		}
+	}
+	producer.join();
+	return ok && expected == count && q.size_approx() == 0;
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+	const size_t n = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 0;
+	const int rounds = argc > 2 ? std::atoi(argv[2]) : 200;
+	const std::vector<size_t> sizes = n > 0 ? std::vector<size_t>{n} : std::vector<size_t>{1000, 10000, 20000, 50000};
+
+	for (size_t size : sizes)
+	{
+		const double single = time_drain(size, rounds, false);
+		const double bulk = time_drain(size, rounds, true);
+		std::printf("%zu entries: per-element %.1f us, bulk %.1f us (%.2fx)\n", size, single * 1e6, bulk * 1e6,
+				single / bulk);
+	}
+
+	const size_t count = 3000000;
+	const bool bulk_ok = check_concurrent(count, false);
+	const bool spans_ok = check_concurrent(count, true);
+	std::printf("Concurrent %zu values: bulk %s, spans %s\n", count, bulk_ok ? "in order" : "FAILED",
+			spans_ok ? "in order" : "FAILED");
+	return bulk_ok && spans_ok ? 0 : 1;
+}
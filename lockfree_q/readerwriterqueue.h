@@ -473,6 +473,85 @@ public:
 		return true;
 	}
 	
+	// Attempts to dequeue up to `max` elements, moving them to `out` in order
+	// (e.g. a std::back_inserter). Returns the number dequeued, 0 if the queue
+	// appeared empty. Each block's run of elements is consumed with a single
+	// update of its front, instead of one per element as with try_dequeue.
+	// Must be called only from the consumer thread.
+	template<typename OutputIt>
+	size_t try_dequeue_bulk(OutputIt out, size_t max) AE_NO_TSAN
+	{
+#ifndef NDEBUG
+		ReentrantGuard guard(this->dequeuing);
+#endif
+		size_t count = 0;
+		while (count != max) {
+			size_t blockFront, blockTail;
+			Block* block = dequeue_block(blockFront, blockTail);
+			if (block == nullptr) {
+				break;
+			}
+
+			size_t n = (blockTail - blockFront) & block->sizeMask;
+			n = n < max - count ? n : max - count;
+			for (size_t i = 0; i != n; ++i) {
+				auto element = reinterpret_cast<T*>(block->data + ((blockFront + i) & block->sizeMask) * sizeof(T));
+				*out = std::move(*element);
+				++out;
+				element->~T();
+			}
+
+			fence(memory_order_release);
+			block->front = (blockFront + n) & block->sizeMask;
+			count += n;
+		}
+		return count;
+	}
+
+	// Returns a pointer to the front element and sets `count` to the number
+	// of elements which follow it contiguously in memory (at least 1), so
+	// they can be read in place. Returns nullptr and sets `count` to 0 if the
+	// queue appears empty. Remove what was read with pop_span().
+	// Must be called only from the consumer thread.
+	T* peek_span(size_t& count) AE_NO_TSAN
+	{
+#ifndef NDEBUG
+		ReentrantGuard guard(this->dequeuing);
+#endif
+		size_t blockFront, blockTail;
+		Block* block = dequeue_block(blockFront, blockTail);
+		if (block == nullptr) {
+			count = 0;
+			return nullptr;
+		}
+
+		// Elements wrap around at the end of the block's storage
+		size_t available = (blockTail - blockFront) & block->sizeMask;
+		size_t untilWrap = block->sizeMask + 1 - blockFront;
+		count = available < untilWrap ? available : untilWrap;
+		return reinterpret_cast<T*>(block->data + blockFront * sizeof(T));
+	}
+
+	// Removes the first `count` elements of the span returned by the last
+	// peek_span(), with a single update of the front. `count` must not
+	// exceed the span's length.
+	// Must be called only from the consumer thread.
+	void pop_span(size_t count) AE_NO_TSAN
+	{
+#ifndef NDEBUG
+		ReentrantGuard guard(this->dequeuing);
+#endif
+		Block* block = frontBlock.load();
+		size_t blockFront = block->front.load();
+		auto element = reinterpret_cast<T*>(block->data + blockFront * sizeof(T));
+		for (size_t i = 0; i != count; ++i) {
+			element[i].~T();
+		}
+
+		fence(memory_order_release);
+		block->front = (blockFront + count) & block->sizeMask;
+	}
+
 	// Returns the approximate number of items currently in the queue.
 	// Safe to call from both the producer and consumer threads.
 	inline size_t size_approx() const AE_NO_TSAN
@@ -705,6 +784,47 @@ private:
 		return new (newBlockAligned) Block(capacity, newBlockRaw, newBlockData);
 	}
 
+	// Returns the block to dequeue from with its front and (freshly read)
+	// tail, moving on to the next block if the front block is empty; nullptr
+	// if the queue appears empty. See try_dequeue() for the reasoning.
+	Block* dequeue_block(size_t& blockFront, size_t& blockTail) AE_NO_TSAN
+	{
+		Block* frontBlock_ = frontBlock.load();
+		blockFront = frontBlock_->front.load();
+		blockTail = frontBlock_->localTail = frontBlock_->tail.load();
+		if (blockFront != blockTail) {
+			fence(memory_order_acquire);
+			return frontBlock_;
+		}
+		if (frontBlock_ == tailBlock.load()) {
+			return nullptr;
+		}
+
+		fence(memory_order_acquire);
+		blockTail = frontBlock_->localTail = frontBlock_->tail.load();
+		blockFront = frontBlock_->front.load();
+		fence(memory_order_acquire);
+		if (blockFront != blockTail) {
+			return frontBlock_;
+		}
+
+		// Front block is empty but there's another block ahead, advance to it
+		Block* nextBlock = frontBlock_->next;
+		blockFront = nextBlock->front.load();
+		blockTail = nextBlock->localTail = nextBlock->tail.load();
+		fence(memory_order_acquire);
+
+		// Since the tailBlock is only ever advanced after being written to,
+		// we know there's for sure an element to dequeue on it
+		assert(blockFront != blockTail);
+
+		// We're done with this block, let the producer use it if it needs
+		fence(memory_order_release);
+		frontBlock = nextBlock;
+		compiler_fence(memory_order_release);
+		return nextBlock;
+	}
+
 private:
 	weak_atomic<Block*> frontBlock;		// (Atomic) Elements are enqueued to this block
 	
@@ -52,34 +52,201 @@
 #include <QCommandLineOption>
 #include <QCommandLineParser>
 #include <QDesktopWidget>
+#include <QOpenGLContext>
 #include <QSurfaceFormat>
 
+#include <algorithm>
+#include <cstring>
+
 #include "glwidget.h"
 #include "mainwindow.h"
+#include "streamoptions.h"
+#include "uploadcontext.h"
+
+/// OpenGL 3.3 core, or OpenGL ES 3.0 when Qt drives an ES implementation
+static QSurfaceFormat surface_format(bool es)
+{
+	QSurfaceFormat fmt;
+	fmt.setDepthBufferSize(24);
+	if (es)
+	{
+		fmt.setVersion(3, 0);
+	}
+	else
+	{
+		fmt.setVersion(3, 3);
+		fmt.setProfile(QSurfaceFormat::CoreProfile);
+	}
+	fmt.setOption(QSurfaceFormat::DebugContext);
+	return fmt;
+}
 
 int main(int argc, char *argv[]) {
+	/* Qt creates the global share context in the QApplication constructor,
+	 * so a format and the sharing attribute must be set before it, when
+	 * QOpenGLContext::openGLModuleType() can't be asked yet. Set the format of
+	 * the GL Qt was built for, and correct it once the module is known.
+	 */
+#ifdef QT_OPENGL_ES_2
+	const bool es_build = true;
+#else
+	const bool es_build = false;
+#endif
+	QSurfaceFormat::setDefaultFormat(surface_format(es_build));
+
+	// lets the widgets' textures be filled from a background context
+	const bool shared_upload =
+			std::any_of(argv + 1, argv + argc, [](const char* arg) { return strcmp(arg, "--shared-upload") == 0; });
+	if (shared_upload)
+	{
+		QCoreApplication::setAttribute(Qt::AA_ShareOpenGLContexts);
+	}
 	QApplication app(argc, argv);
 
+	// e.g. a desktop build running on ANGLE or with QT_OPENGL=es2
+	const bool es = QOpenGLContext::openGLModuleType() != QOpenGLContext::LibGL;
+	if (es)
+		qDebug("Requesting 3.0 context");
+	else
+		qDebug("Requesting 3.3 core context");
+	if (es != es_build)
+	{
+		QSurfaceFormat::setDefaultFormat(surface_format(es));
+	}
+
 	QCoreApplication::setApplicationName("Matrix widget");
 	QCoreApplication::setOrganizationName("QtProject");
 	QCoreApplication::setApplicationVersion(QT_VERSION_STR);
-	QSurfaceFormat fmt;
-	fmt.setDepthBufferSize(24);
 
-	// Request OpenGL 3.3 core or OpenGL ES 3.0.
-	if (QOpenGLContext::openGLModuleType() == QOpenGLContext::LibGL) {
-		qDebug("Requesting 3.3 core context");
-		fmt.setVersion(3, 3);
-		fmt.setProfile(QSurfaceFormat::CoreProfile);
-	} else {
-		qDebug("Requesting 3.0 context");
-		fmt.setVersion(3, 0);
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Streaming matrix display");
+	parser.addHelpOption();
+	QCommandLineOption rowsOption("rows", "Matrix rows.", "n", "360");
+	QCommandLineOption colsOption("cols", "Matrix columns.", "n", "2000");
+	QCommandLineOption widgetsOption("widgets", "Number of matrix widgets.", "n", "1");
+	QCommandLineOption layersOption("layers", "Matrices per widget, sharing one texture array and draw call.", "n", "1");
+	QCommandLineOption rateOption("rate", "Generated rows/s per widget, 0 = unpaced.", "rows/s", "1200");
+	QCommandLineOption burstOption("burst", "Generated rows appended back to back.", "rows", "1");
+	QCommandLineOption dutyOption("duty", "Generator on/off duty cycle.", "on_ms:off_ms");
+	QCommandLineOption producersOption("producers", "Generator threads, spread over the widgets; at least one per widget.", "n", "1");
+	QCommandLineOption patternOption("pattern", "Generated row order, sequential, random or columns.", "order", "sequential");
+	QCommandLineOption bandOption("band", "Generate column bands of this width instead of whole rows.", "cols", "0");
+	parser.addOption(rowsOption);
+	parser.addOption(colsOption);
+	parser.addOption(widgetsOption);
+	parser.addOption(layersOption);
+	parser.addOption(rateOption);
+	parser.addOption(burstOption);
+	parser.addOption(dutyOption);
+	parser.addOption(producersOption);
+	parser.addOption(patternOption);
+	parser.addOption(bandOption);
+	QCommandLineOption spectrogramOption("spectrogram",
+			"Generate time domain samples and show their spectrogram in dB, one row every hop samples; 0 = off.",
+			"hop", "0");
+	parser.addOption(spectrogramOption);
+	QCommandLineOption transferOption("transfer", "Display transfer function: linear, db, sqrt or gamma.", "name", "linear");
+	QCommandLineOption transferParamOption("transfer-param", "Reference power for db, exponent for gamma.", "value", "1");
+	parser.addOption(transferOption);
+	parser.addOption(transferParamOption);
+	QCommandLineOption dbRangeOption("db-range", "dB shown from black to the top of the colour map without auto contrast.",
+			"floor:ceiling", "-60:0");
+	parser.addOption(dbRangeOption);
+	QCommandLineOption interpolationOption("interpolation", "Display interpolation: nearest, bilinear or bicubic.", "name", "nearest");
+	parser.addOption(interpolationOption);
+	QCommandLineOption complexOption("complex",
+			"Rows of interleaved I/Q pairs, shown as magnitude, logmag (in dB, no transfer applied) or phase; off for real samples.",
+			"view", "off");
+	parser.addOption(complexOption);
+	QCommandLineOption sharedUploadOption("shared-upload", "Upload all widgets from one background GL context.");
+	parser.addOption(sharedUploadOption);
+	QCommandLineOption uploadStrategyOption("upload-strategy",
+			"Texture uploads: auto (calibrated), direct, subdata, orphan, unsync or persistent.", "name", "auto");
+	parser.addOption(uploadStrategyOption);
+	QCommandLineOption replayOption("replay", "Replay a recorded row stream.", "file");
+	QCommandLineOption replayRateOption("replay-rate", "Replay rate in rows/s, 0 = as fast as possible.", "rows/s", "0");
+	QCommandLineOption recordOption("record", "Record the displayed rows to a file.", "file");
+	QCommandLineOption recordDirectOption("record-direct", "Write the recording with O_DIRECT.");
+	QCommandLineOption ingestShmOption("ingest-shm", "Accept rows through a shared memory ring.", "name");
+	QCommandLineOption ingestSlotsOption("ingest-slots", "Rows in the shared memory ring, a power of two.", "rows", "16384");
+	QCommandLineOption ingestSocketOption("ingest-socket", "Accept rows on a unix domain socket.", "path");
+	parser.addOption(replayOption);
+	parser.addOption(replayRateOption);
+	parser.addOption(recordOption);
+	parser.addOption(recordDirectOption);
+	parser.addOption(ingestShmOption);
+	parser.addOption(ingestSlotsOption);
+	parser.addOption(ingestSocketOption);
+	QCommandLineOption ingestPolicyOption("ingest-policy",
+			"Full queues: unbounded, drop (newest), collapse (to the latest per row) or drain (off-screen into a CPU copy).",
+			"policy", "unbounded");
+	parser.addOption(ingestPolicyOption);
+	QCommandLineOption sparseFillOption("sparse-fill",
+			"Queue rows as runs of non-zero values while these take at most this fraction of the row, 0 = never.",
+			"ratio", "0.25");
+	parser.addOption(sparseFillOption);
+	parser.process(app);
+
+	StreamOptions options;
+	options.rows = std::max(1, parser.value(rowsOption).toInt());
+	options.cols = std::max(1, parser.value(colsOption).toInt());
+	options.widgets = std::max(1, parser.value(widgetsOption).toInt());
+	options.layers = std::max(1, parser.value(layersOption).toInt());
+	options.gen_rate = std::max(0.0, parser.value(rateOption).toDouble());
+	options.gen_burst = std::max(1, parser.value(burstOption).toInt());
+	options.producers = std::max(1, parser.value(producersOption).toInt());
+	options.gen_random_rows = parser.value(patternOption) == "random";
+	options.gen_columns = parser.value(patternOption) == "columns";
+	options.gen_band_cols = std::max(0, parser.value(bandOption).toInt());
+	options.spectrogram_hop = std::max(0, parser.value(spectrogramOption).toInt());
+	if (parser.isSet(dutyOption))
+	{
+		QStringList duty = parser.value(dutyOption).split(':');
+		if (duty.size() == 2)
+		{
+			options.gen_duty_on_ms = duty[0].toInt();
+			options.gen_duty_off_ms = duty[1].toInt();
+		}
 	}
-	fmt.setOption(QSurfaceFormat::DebugContext);
+	options.replay_file = parser.value(replayOption).toStdString();
+	options.replay_rate = parser.value(replayRateOption).toDouble();
+	options.record_file = parser.value(recordOption).toStdString();
+	options.record_direct_io = parser.isSet(recordDirectOption);
+	options.ingest_shm = parser.value(ingestShmOption).toStdString();
+	options.ingest_slots = parser.value(ingestSlotsOption).toLongLong();
+	options.ingest_socket = parser.value(ingestSocketOption).toStdString();
+	const QStringList policies{"unbounded", "drop", "collapse", "drain"};
+	options.ingest_policy = std::max(0, policies.indexOf(parser.value(ingestPolicyOption).toLower()));
+	options.sparse_fill = std::max(0.0, parser.value(sparseFillOption).toDouble());
+	const QStringList strategies{"auto", "direct", "subdata", "orphan", "unsync", "persistent"};
+	options.upload_strategy = std::max(0, strategies.indexOf(parser.value(uploadStrategyOption).toLower()));
+	const QStringList transfers{"linear", "db", "sqrt", "gamma"};
+	options.transfer = std::max(0, transfers.indexOf(parser.value(transferOption).toLower()));
+	if (options.spectrogram_hop > 0 && !parser.isSet(transferOption))
+	{
+		// the spectrogram rows are power relative to a full scale sine, shown over the dB range
+		options.transfer = int(GLWidget::Transfer::Decibel);
+	}
+	options.transfer_param = parser.value(transferParamOption).toDouble();
+	const QStringList db_range = parser.value(dbRangeOption).split(':');
+	if (db_range.size() == 2 && db_range[1].toDouble() > db_range[0].toDouble())
+	{
+		options.db_floor = db_range[0].toDouble();
+		options.db_ceiling = db_range[1].toDouble();
+	}
+	const QStringList interpolations{"nearest", "bilinear", "bicubic"};
+	options.interpolation = std::max(0, interpolations.indexOf(parser.value(interpolationOption).toLower()));
+	const QStringList complex_views{"off", "magnitude", "logmag", "phase"};
+	options.complex_view = std::max(0, complex_views.indexOf(parser.value(complexOption).toLower()));
+	if (options.spectrogram_hop > 0)
+		options.complex_view = 0; // spectrogram rows are real
 
-	QSurfaceFormat::setDefaultFormat(fmt);
+	if (shared_upload)
+	{
+		UploadContext::enable();
+	}
 
-	MainWindow mainWindow;
+	MainWindow mainWindow(options);
 	mainWindow.resize(mainWindow.sizeHint());
 	int desktopArea =
 		QApplication::desktop()->width() * QApplication::desktop()->height();
@@ -54,7 +54,8 @@
 #include <QMenuBar>
 #include <QMessageBox>
 
-MainWindow::MainWindow()
+MainWindow::MainWindow(const StreamOptions& options)
+	: options(options)
 {
 	QMenuBar* menuBar = new QMenuBar;
 	QMenu* menuWindow = menuBar->addMenu(tr("&Window"));
@@ -70,7 +71,13 @@ MainWindow::MainWindow()
 void MainWindow::onAddNew()
 {
 	if (!centralWidget())
-		setCentralWidget(new Window(this));
+	{
+		setCentralWidget(new Window(this, options));
+		// only the first window records and owns the ingest endpoints
+		options.record_file.clear();
+		options.ingest_shm.clear();
+		options.ingest_socket.clear();
+	}
 	else
 		QMessageBox::information(0, tr("Cannot add new window"), tr("Already occupied. Undock first."));
 }
@@ -53,15 +53,20 @@
 
 #include <QMainWindow>
 
+#include "streamoptions.h"
+
 class MainWindow : public QMainWindow
 {
 	Q_OBJECT
 
 public:
-	MainWindow();
+	MainWindow(const StreamOptions& options);
 
 private slots:
 	void onAddNew();
+
+private:
+	StreamOptions options;
 };
 
 #endif
@@ -0,0 +1,159 @@
+#ifndef MATRIXFILE_H
+#define MATRIXFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+/* On-disk format of a recorded row stream:
+ *
+ * - A fixed header, padded to header_block bytes, so the row data starts
+ *   block aligned (needed by writers using O_DIRECT).
+ * - row_count records in arrival order, native endian: a Record giving the
+ *   matrix row and the columns [col_begin, col_begin + count) written,
+ *   followed by those count samples. Records are back to back, so they are
+ *   read front to back.
+ *
+ * rows x cols is the matrix the stream was displayed with, cols counting
+ * values; with two components, a row holds cols / 2 interleaved I/Q pairs
+ * and records start and end on whole pairs. A replay uses these to size the
+ * widget and writes each record where it was written then.
+ */
+namespace matrixfile
+{
+
+constexpr char magic[8] = {'Q', 'S', 'M', 'R', 'O', 'W', 'S', '\0'};
+constexpr uint32_t version = 3;
+constexpr size_t header_block = 4096;
+
+enum class DType : uint32_t
+{
+	Float32 = 1,
+	Float64 = 2,
+	Int16 = 3,
+	UInt16 = 4,
+};
+
+struct Header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t dtype;
+	uint64_t rows;
+	uint64_t cols;
+	uint64_t row_count;   ///< records; 0 if the writer didn't finish, count the complete ones then
+	uint64_t data_offset; ///< byte offset of the first record
+	uint32_t components;  ///< 1 for real samples, 2 for I/Q pairs
+	uint32_t reserved;
+};
+
+struct Record
+{
+	uint32_t row;
+	uint32_t col_begin;
+	uint32_t count; ///< samples following the record
+	uint32_t reserved;
+};
+
+inline size_t dtype_size(uint32_t dtype)
+{
+	switch (static_cast<DType>(dtype))
+	{
+	case DType::Float32:
+		return 4;
+	case DType::Float64:
+		return 8;
+	case DType::Int16:
+	case DType::UInt16:
+		return 2;
+	}
+	return 0;
+}
+
+inline Header make_header(uint64_t rows, uint64_t cols, uint32_t components = 1, DType dtype = DType::Float32)
+{
+	Header h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, magic, sizeof(magic));
+	h.version = version;
+	h.dtype = static_cast<uint32_t>(dtype);
+	h.rows = rows;
+	h.cols = cols;
+	h.row_count = 0;
+	h.data_offset = header_block;
+	h.components = components;
+	return h;
+}
+
+/* Reads the record at offset of a file of size bytes; false if it isn't
+ * complete or lies outside the matrix. On success, offset is advanced to the
+ * next record and samples points at the record's samples.
+ */
+inline bool next_record(const Header& h, const unsigned char* data, size_t size, size_t& offset, Record& r,
+		const unsigned char*& samples)
+{
+	if (offset > size || size - offset < sizeof(Record))
+		return false;
+	memcpy(&r, data + offset, sizeof(Record)); // the mapping may be unaligned
+	const uint64_t bytes = uint64_t(r.count) * dtype_size(h.dtype);
+	if (r.row >= h.rows || r.count == 0 || uint64_t(r.col_begin) + r.count > h.cols ||
+			r.col_begin % h.components || r.count % h.components || size - offset - sizeof(Record) < bytes)
+		return false;
+	samples = data + offset + sizeof(Record);
+	offset += sizeof(Record) + bytes;
+	return true;
+}
+
+/// Checks the header against the file contents; on success, fixes up row_count.
+inline bool validate(Header& h, const unsigned char* data, size_t file_size, std::string& error)
+{
+	if (memcmp(h.magic, magic, sizeof(magic)) != 0)
+	{
+		error = "not a matrix recording (bad magic)";
+		return false;
+	}
+	if (h.version != version)
+	{
+		error = "unsupported version " + std::to_string(h.version);
+		return false;
+	}
+	const size_t sample_size = dtype_size(h.dtype);
+	if (sample_size == 0 || h.rows == 0 || h.cols == 0)
+	{
+		error = "invalid dtype or dimensions";
+		return false;
+	}
+	if ((h.components != 1 && h.components != 2) || h.cols % h.components)
+	{
+		error = "invalid component count " + std::to_string(h.components);
+		return false;
+	}
+	if (h.data_offset < sizeof(Header) || h.data_offset > file_size)
+	{
+		error = "data offset out of range";
+		return false;
+	}
+
+	if (h.row_count == 0)
+	{
+		// the writer was interrupted: walk the records up to the first incomplete one
+		size_t offset = h.data_offset;
+		Record r;
+		const unsigned char* samples;
+		while (next_record(h, data, file_size, offset, r, samples))
+		{
+			++h.row_count;
+		}
+	}
+	if (h.row_count == 0)
+	{
+		error = "no rows recorded";
+		return false;
+	}
+	return true;
+}
+
+} // namespace matrixfile
+
+#endif
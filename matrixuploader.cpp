@@ -0,0 +1,811 @@
+#include "matrixuploader.h"
+
+#include <QOpenGLContext>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <iostream>
+#include <limits>
+#include <utility>
+
+const char* MatrixUploader::strategyName(UploadStrategy strategy)
+{
+	switch (strategy)
+	{
+	case UploadStrategy::Auto:
+		return "auto";
+	case UploadStrategy::Direct:
+		return "direct";
+	case UploadStrategy::BufferSubData:
+		return "subdata";
+	case UploadStrategy::Orphan:
+		return "orphan";
+	case UploadStrategy::MapUnsynchronized:
+		return "unsync";
+	case UploadStrategy::PersistentMap:
+		return "persistent";
+	}
+	return "";
+}
+
+MatrixUploader::MatrixUploader(int rows, int cols, int layers, int components)
+	: upload_requested(false)
+	, tex_width(cols * (components == 2 ? 2 : 1))
+	, tex_height(rows)
+	, n_layers(std::max(layers, 1))
+	, n_components(components == 2 ? 2 : 1)
+	, n_channels(1)
+	, stats_enabled(false)
+	, ingest_policy(IngestPolicy::Unbounded)
+	, sparse_fill(0.25f)
+	, sparse_rows(0)
+	, dropped_rows(0)
+	, collapsed_rows(0)
+	, drained_rows(0)
+	, wanted_strategy(UploadStrategy::Auto)
+	, upload_strategy(UploadStrategy::Auto)
+	, published(-1)
+	, in_use(-1)
+	, shared(false)
+	, initialized(false)
+	, mipmaps_wanted(false)
+	, filtering_wanted(false)
+	, lod_supported(false)
+	, float_filterable(false)
+	, texture_storage(false)
+	, max_lod(int(std::log2(std::max(rows, cols))))
+	, init_time(0.0)
+	, upload_time(0.0)
+	, copy_time(0.0)
+	, upload_rows(0.0)
+	, upload_ranges(0.0)
+	, staging_bytes(0)
+	, staging_wait(0.0)
+	, time_cnt(0)
+{
+	channels[0] = std::make_unique<Channel>(0, rowCount());
+	shadow.assign(dataCount(), T(0));
+}
+
+MatrixUploader::~MatrixUploader() { assert(!isInitialized() && "destroy() must be called with a context current"); }
+
+MatrixUploader::Producer MatrixUploader::add_producer(int row_begin, int row_end)
+{
+	row_begin = std::max(row_begin, 0);
+	row_end = std::min(row_end, rowCount());
+	if (row_begin >= row_end)
+	{
+		return Producer();
+	}
+
+	std::lock_guard<std::mutex> lock(channels_mutex);
+	const size_t n = n_channels.load();
+	if (n == max_channels)
+	{
+		std::cerr << "Too many producers for one widget\n";
+		return Producer();
+	}
+	channels[n] = std::make_unique<Channel>(row_begin, row_end);
+	if (recorder)
+	{
+		channels[n]->recorder_port = recorder->add_port();
+	}
+	n_channels.store(n + 1, std::memory_order_release);
+	return Producer(this, channels[n].get());
+}
+
+void MatrixUploader::set_recorder(std::shared_ptr<RowRecorder> r)
+{
+	std::lock_guard<std::mutex> lock(channels_mutex);
+	recorder = std::move(r);
+	for (size_t i = 0; i < n_channels.load(); ++i)
+	{
+		channels[i]->recorder_port = recorder ? recorder->add_port() : nullptr;
+	}
+}
+
+bool MatrixUploader::insert_sparse(Channel& c, int pos, SparseRow input)
+{
+	if (pos < c.row_begin || pos >= c.row_end)
+	{
+		return false;
+	}
+	size_t n_values = 0;
+	int col = 0;
+	for (const SparseRow::Run& run : input.runs)
+	{
+		if (run.col_begin < col || run.count < 0 || run.col_begin + run.count > tex_width)
+		{
+			std::cerr << "Sparse row with runs out of order or range\n";
+			return false;
+		}
+		col = run.col_begin + run.count;
+		n_values += run.count;
+	}
+	if (n_values != input.values.size())
+	{
+		std::cerr << "Sparse row with " << input.values.size() << " values for runs of " << n_values << "\n";
+		return false;
+	}
+
+	if (stats_enabled.load(std::memory_order_relaxed))
+	{
+		std::lock_guard<std::mutex> lock(c.stats_mutex);
+		c.stats.add(input.values.data(), n_values);
+		c.stats.add_constant(input.background, tex_width - n_values);
+	}
+	// the recording format holds dense rows
+	if (c.recorder_port)
+	{
+		auto dense = std::make_shared<Row>(tex_width);
+		rowcodec::expand(input, dense->data(), tex_width);
+		recorder->push(c.recorder_port, pos, 0, std::move(dense));
+	}
+	sparse_rows.fetch_add(1, std::memory_order_relaxed);
+	return queue_entry(c, Entry{pos, 0, nullptr, std::make_shared<const SparseRow>(std::move(input))});
+}
+
+void MatrixUploader::append_columns(Channel& c, const T* columns, int n)
+{
+	if (n_components != 1)
+	{
+		std::cerr << "Columns can only be appended to a matrix of one component\n";
+		return;
+	}
+	const int rows = c.row_end - c.row_begin;
+	if (n > tex_width)
+	{
+		// all but the last tex_width columns would be overwritten right away
+		const int skipped = n - tex_width;
+		columns += size_t(skipped) * rows;
+		c.append_col = (c.append_col + skipped) % tex_width;
+		n = tex_width;
+	}
+	if (stats_enabled.load(std::memory_order_relaxed) && n > 0)
+	{
+		std::lock_guard<std::mutex> lock(c.stats_mutex);
+		c.stats.add(columns, size_t(n) * rows);
+	}
+	while (n > 0)
+	{
+		// one block per side of the wrap-around
+		const int block_cols = std::min(n, tex_width - c.append_col);
+		auto block = std::make_shared<Row>(size_t(block_cols) * rows);
+		rowcodec::transpose(columns, block_cols, rows, block->data());
+		// the recording format holds one row per record
+		if (c.recorder_port)
+		{
+			for (int r = 0; r < rows; ++r)
+			{
+				const T* row = block->data() + size_t(r) * block_cols;
+				recorder->push(c.recorder_port, c.row_begin + r, c.append_col,
+						std::make_shared<Row>(row, row + block_cols));
+			}
+		}
+		queue_entry(c, Entry{c.row_begin, c.append_col, std::move(block), nullptr, rows});
+
+		columns += size_t(block_cols) * rows;
+		n -= block_cols;
+		c.append_col = (c.append_col + block_cols) % tex_width;
+	}
+}
+
+bool MatrixUploader::queue_entry(Channel& c, Entry e)
+{
+	switch (ingest_policy)
+	{
+	case IngestPolicy::Unbounded:
+		c.input_q.enqueue(std::move(e));
+		return true;
+
+	case IngestPolicy::CollapseLatest:
+	{
+		// try_enqueue() only moves from e when it succeeds
+		if (!c.overflowing.load(std::memory_order_relaxed) && c.input_q.try_enqueue(std::move(e)))
+		{
+			return true;
+		}
+		std::lock_guard<std::mutex> lock(c.overflow_mutex);
+		c.overflowing.store(true, std::memory_order_release);
+		if (c.overflow.empty())
+		{
+			c.overflow.resize(c.row_end - c.row_begin);
+		}
+		if (e.rows == 1)
+		{
+			return overflow_entry(c, std::move(e));
+		}
+		// the overflow is kept per row, so a block of columns is split into its rows
+		const size_t width = size_t(entryEnd(e) - e.col_begin);
+		bool queued = true;
+		for (int r = 0; r < e.rows; ++r)
+		{
+			auto first = e.values->begin() + r * width;
+			auto row = std::make_shared<Row>(first, first + width);
+			queued &= overflow_entry(c, Entry{e.matrix_row + r, e.col_begin, std::move(row), nullptr});
+		}
+		return queued;
+	}
+
+	case IngestPolicy::DropNewest:
+	case IngestPolicy::DrainToShadow:
+		break;
+	}
+	if (c.input_q.try_enqueue(std::move(e)))
+	{
+		return true;
+	}
+	dropped_rows.fetch_add(1, std::memory_order_relaxed);
+	return false;
+}
+
+bool MatrixUploader::overflow_entry(Channel& c, Entry e)
+{
+	std::vector<Entry>& pending = c.overflow[e.matrix_row - c.row_begin];
+	if (pending.empty())
+	{
+		c.overflow_rows.push_back(e.matrix_row);
+	}
+	if (e.col_begin == 0 && entryEnd(e) == tex_width)
+	{
+		collapsed_rows.fetch_add(long(pending.size()), std::memory_order_relaxed);
+		pending.clear();
+	}
+	else if (pending.size() == max_pending_bands)
+	{
+		dropped_rows.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	pending.push_back(std::move(e));
+	return true;
+}
+
+void MatrixUploader::drain_queues(std::vector<Entry>& entries)
+{
+	const size_t n = n_channels.load(std::memory_order_acquire);
+	for (size_t i = 0; i < n; ++i)
+	{
+		Channel& c = *channels[i];
+		// in bulk: one update of the queue's front per block instead of one per entry
+		c.input_q.try_dequeue_bulk(std::back_inserter(entries), std::numeric_limits<size_t>::max());
+		if (!c.overflowing.load(std::memory_order_acquire))
+		{
+			continue;
+		}
+
+		std::lock_guard<std::mutex> lock(c.overflow_mutex);
+		// what the producer queued before it switched to the overflow is older than the overflow
+		c.input_q.try_dequeue_bulk(std::back_inserter(entries), std::numeric_limits<size_t>::max());
+		for (int row : c.overflow_rows)
+		{
+			std::vector<Entry>& pending = c.overflow[row - c.row_begin];
+			std::move(pending.begin(), pending.end(), std::back_inserter(entries));
+			pending.clear();
+		}
+		c.overflow_rows.clear();
+		c.overflowing.store(false, std::memory_order_relaxed);
+	}
+}
+
+void MatrixUploader::apply_to_shadow(const std::vector<Entry>& entries)
+{
+	for (const Entry& e : entries)
+	{
+		if (e.sparse)
+		{
+			rowcodec::expand(*e.sparse, &shadow[size_t(e.matrix_row) * tex_width], tex_width);
+			continue;
+		}
+		const Row& values = *e.values;
+		const int width = int(values.size() / e.rows);
+		assert(e.col_begin + width <= tex_width);
+		rowcodec::write_block(values.data(), e.rows, width, shadow.data(), tex_width, e.matrix_row, e.col_begin);
+	}
+}
+
+size_t MatrixUploader::queuedWrites() const
+{
+	size_t n = 0;
+	const size_t active = n_channels.load(std::memory_order_acquire);
+	for (size_t i = 0; i < active; ++i)
+	{
+		n += channels[i]->input_q.size_approx();
+	}
+	return n;
+}
+
+size_t MatrixUploader::drain_to_shadow()
+{
+	std::lock_guard<std::mutex> lock(consume_mutex);
+	const size_t n = consume_queues();
+	drained_rows.fetch_add(long(n), std::memory_order_relaxed);
+	return n;
+}
+
+size_t MatrixUploader::consume_queues()
+{
+	frame_entries.clear();
+	drain_queues(frame_entries);
+	apply_to_shadow(frame_entries);
+
+	// the shadow has the result of all writes, so only the rectangles of runs of adjacent rows matter
+	std::sort(frame_entries.begin(), frame_entries.end(),
+			[](const Entry& a, const Entry& b) { return a.matrix_row < b.matrix_row; });
+	Rect run{0, 0, 0, 0};
+	for (const Entry& e : frame_entries)
+	{
+		// update_band() only takes whole pairs of a complex matrix, so these are whole texels
+		const int col_end = entryEnd(e);
+		if (e.matrix_row > run.row_end || run.row_end == 0)
+		{
+			if (run.row_end > 0)
+				mark_dirty(run);
+			run = Rect{e.matrix_row, e.matrix_row + e.rows, e.col_begin, col_end};
+			continue;
+		}
+		run.row_end = std::max(run.row_end, e.matrix_row + e.rows);
+		run.col_begin = std::min(run.col_begin, e.col_begin);
+		run.col_end = std::max(run.col_end, col_end);
+	}
+	if (run.row_end > 0)
+		mark_dirty(run);
+
+	const size_t n = frame_entries.size();
+	// drop the row references now rather than holding them until the next upload
+	frame_entries.clear();
+	return n;
+}
+
+
+IntensitySummary MatrixUploader::intensitySummary(float low_q, float high_q)
+{
+	std::vector<IntensitySketch> sketches(n_channels.load(std::memory_order_acquire));
+	for (size_t i = 0; i < sketches.size(); ++i)
+	{
+		std::lock_guard<std::mutex> lock(channels[i]->stats_mutex);
+		sketches[i] = channels[i]->stats;
+	}
+	return IntensitySketch::summarize(sketches, low_q, high_q);
+}
+
+void MatrixUploader::initialize(bool shared)
+{
+	std::lock_guard<std::mutex> consume_lock(consume_mutex);
+	timer.start();
+	initializeOpenGLFunctions();
+	this->shared = shared;
+
+	// R32F is only filterable (and thus mipmappable) on desktop GL; ES 3 needs an extension for filtering
+	QOpenGLContext* context = QOpenGLContext::currentContext();
+	lod_supported = !context->isOpenGLES();
+	float_filterable = lod_supported || context->hasExtension(QByteArrayLiteral("GL_OES_texture_float_linear"));
+	// immutable textures are core in ES 3.0 and GL 4.2; the GL 3.3 we ask for may have the extension
+	texture_storage = context->isOpenGLES() || context->format().version() >= qMakePair(4, 2) ||
+			context->hasExtension(QByteArrayLiteral("GL_ARB_texture_storage"));
+
+	published = -1;
+	in_use = -1;
+
+	initTextures();
+	UploadStrategy strategy = wanted_strategy == UploadStrategy::Auto ? calibrate() : wanted_strategy;
+	if (!init_staging(strategy))
+	{
+		std::cerr << "The " << strategyName(strategy) << " upload strategy isn't supported, mapping unsynchronized\n";
+		init_staging(UploadStrategy::MapUnsynchronized);
+	}
+	staging_bytes.store(ring.capacity(), std::memory_order_relaxed);
+	init_time.store(timer.nsecsElapsed() * 1e-9, std::memory_order_relaxed);
+	initialized.store(true, std::memory_order_release);
+}
+
+void MatrixUploader::destroy()
+{
+	if (!isInitialized())
+		return;
+
+	std::lock_guard<std::mutex> consume_lock(consume_mutex);
+	std::lock_guard<std::mutex> lock(textures_mutex);
+	for (auto& slot : textures)
+	{
+		glDeleteTextures(1, &slot.id);
+		if (slot.written)
+			glDeleteSync(slot.written);
+		if (slot.sampled)
+			glDeleteSync(slot.sampled);
+	}
+	textures.clear();
+	published = -1;
+	in_use = -1;
+	ring.destroy();
+	initialized.store(false, std::memory_order_release);
+}
+
+void MatrixUploader::initTextures()
+{
+	std::lock_guard<std::mutex> lock(textures_mutex);
+	const GLenum target = textureTarget();
+	// the new textures start out as the shadow matrix, which holds every write drained so far
+	textures.assign(shared ? 3 : 1, TextureSlot{0, internalFormat(false), false, nullptr, nullptr, {}});
+	for (auto& slot : textures)
+	{
+		allocate_storage(slot, internalFormat(false), false);
+	}
+	glBindTexture(target, 0);
+}
+
+void MatrixUploader::allocate_storage(TextureSlot& slot, GLenum format, bool mipmapped)
+{
+	const GLenum target = textureTarget();
+	if (texture_storage && slot.id)
+	{
+		// immutable storage can't be re-specified, that takes a new texture
+		glDeleteTextures(1, &slot.id);
+		slot.id = 0;
+	}
+	if (!slot.id)
+	{
+		glGenTextures(1, &slot.id);
+	}
+	glBindTexture(target, slot.id);
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, mipmapped ? GL_NEAREST_MIPMAP_NEAREST : GL_NEAREST);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, lod_supported ? max_lod : 0);
+
+	// straight from client memory, both formats take float rows
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	const T* data = shadow.data();
+	const GLsizei width = texelColumnCount();
+	const GLenum pixels = pixelFormat();
+	if (texture_storage)
+	{
+		// the mip levels are part of immutable storage, only allocate them when they're used
+		const GLsizei levels = mipmapped ? max_lod + 1 : 1;
+		if (n_layers > 1)
+		{
+			glTexStorage3D(target, levels, format, width, tex_height, n_layers);
+			glTexSubImage3D(target, 0, 0, 0, 0, width, tex_height, n_layers, pixels, GL_FLOAT, data);
+		}
+		else
+		{
+			glTexStorage2D(target, levels, format, width, tex_height);
+			glTexSubImage2D(target, 0, 0, 0, width, tex_height, pixels, GL_FLOAT, data);
+		}
+	}
+	else if (n_layers > 1)
+		glTexImage3D(target, 0, format, width, tex_height, n_layers, 0, pixels, GL_FLOAT, data);
+	else
+		glTexImage2D(target, 0, format, width, tex_height, 0, pixels, GL_FLOAT, data);
+	slot.format = format;
+	slot.mipmapped = mipmapped;
+	slot.dirty.clear();
+}
+
+void MatrixUploader::upload()
+{
+	auto call_with_timer = [this](std::atomic<double>& accum, auto fn) {
+		timer.start();
+		fn();
+		double elapsed = timer.nsecsElapsed() * 1e-9;
+		accum.store((time_cnt > 0) ? 0.9 * accum.load() + 0.1 * elapsed : elapsed, std::memory_order_relaxed);
+	};
+
+	std::lock_guard<std::mutex> consume_lock(consume_mutex);
+	size_t n_writes = 0;
+	call_with_timer(upload_time, [this, &n_writes] { n_writes = consume_queues(); });
+
+	// with several textures, write one which is neither published nor being sampled
+	int target = 0;
+	GLsync sampled = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(textures_mutex);
+		while (shared && (target == published || target == in_use))
+		{
+			++target;
+		}
+		std::swap(sampled, textures[target].sampled);
+	}
+	TextureSlot& slot = textures[target];
+	if (sampled)
+	{
+		// the last draw reading this texture has to be done before it's overwritten
+		glWaitSync(sampled, 0, GL_TIMEOUT_IGNORED);
+		glDeleteSync(sampled);
+	}
+
+	const GLenum format = internalFormat(filtering_wanted.load(std::memory_order_relaxed) && !float_filterable);
+	const bool mipmaps = lod_supported && mipmaps_wanted.load(std::memory_order_relaxed);
+	const bool reallocate = slot.format != format || (texture_storage && slot.mipmapped != mipmaps);
+	if (reallocate)
+	{
+		// the new storage is filled with the whole shadow matrix
+		allocate_storage(slot, format, mipmaps);
+	}
+	else
+	{
+		glBindTexture(textureTarget(), slot.id);
+	}
+
+	const size_t n_rects = slot.dirty.size();
+	call_with_timer(copy_time, [this, &slot, reallocate, mipmaps] {
+		bool changed = reallocate || !slot.dirty.empty();
+		size_t staged = 0;
+		auto done = slot.dirty.begin();
+		while (done != slot.dirty.end() && stage_rect(*done, staged))
+		{
+			++done;
+		}
+		// what couldn't be staged stays dirty for the next upload
+		slot.dirty.erase(slot.dirty.begin(), done);
+		if (ring.isInitialized() && staged > 0)
+		{
+			ring.fence();
+		}
+		if (ring.isInitialized() && staged > ring.capacity() / ring_frames)
+		{
+			// a burst; the next one of its size shouldn't have to wait for the GPU
+			ring.grow(std::min(ring_frames * staged, dataCount() * sizeof(T)));
+			staging_bytes.store(ring.capacity(), std::memory_order_relaxed);
+		}
+
+		if (mipmaps != slot.mipmapped)
+		{
+			// mutable storage; the levels are (re)allocated by glGenerateMipmap()
+			glTexParameteri(textureTarget(), GL_TEXTURE_MIN_FILTER, mipmaps ? GL_NEAREST_MIPMAP_NEAREST : GL_NEAREST);
+			slot.mipmapped = mipmaps;
+			changed = true;
+		}
+		if (mipmaps && changed)
+		{
+			glGenerateMipmap(textureTarget()); // per layer for arrays
+		}
+	});
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glBindTexture(textureTarget(), 0);
+
+	upload_rows.store((time_cnt > 0) ? 0.9 * upload_rows.load() + 0.1 * n_writes : n_writes, std::memory_order_relaxed);
+	upload_ranges.store((time_cnt > 0) ? 0.9 * upload_ranges.load() + 0.1 * n_rects : n_rects,
+			std::memory_order_relaxed);
+	staging_wait.store(ring.waitTime(), std::memory_order_relaxed);
+	++time_cnt;
+
+	GLsync written = nullptr;
+	if (shared)
+	{
+		written = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glFlush(); // other contexts only see the fence once it is flushed
+	}
+
+	std::lock_guard<std::mutex> lock(textures_mutex);
+	if (slot.written)
+	{
+		glDeleteSync(slot.written);
+	}
+	slot.written = written;
+	published = target;
+}
+
+
+MatrixUploader::TextureView MatrixUploader::acquire_texture()
+{
+	// called from the sampling context, which needn't be the one our functions were resolved for
+	QOpenGLExtraFunctions* f = QOpenGLContext::currentContext()->extraFunctions();
+
+	std::lock_guard<std::mutex> lock(textures_mutex);
+	if (published < 0)
+	{
+		return TextureView{0, false, false};
+	}
+	in_use = published;
+	TextureSlot& slot = textures[in_use];
+	if (slot.written)
+	{
+		f->glWaitSync(slot.written, 0, GL_TIMEOUT_IGNORED);
+		f->glDeleteSync(slot.written);
+		slot.written = nullptr;
+	}
+	return TextureView{slot.id, slot.mipmapped, float_filterable || slot.format == internalFormat(true)};
+}
+
+void MatrixUploader::release_texture()
+{
+	QOpenGLExtraFunctions* f = QOpenGLContext::currentContext()->extraFunctions();
+
+	GLsync sampled = nullptr;
+	if (shared)
+	{
+		sampled = f->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		f->glFlush();
+	}
+
+	std::lock_guard<std::mutex> lock(textures_mutex);
+	if (in_use < 0)
+	{
+		return;
+	}
+	std::swap(sampled, textures[in_use].sampled);
+	if (sampled)
+	{
+		f->glDeleteSync(sampled);
+	}
+	in_use = -1;
+}
+
+bool MatrixUploader::init_staging(UploadStrategy strategy)
+{
+	upload_strategy.store(strategy, std::memory_order_relaxed);
+	StagingRing::Mode mode = StagingRing::Mode::MapUnsynchronized;
+	switch (strategy)
+	{
+	case UploadStrategy::Direct:
+		return true;
+	case UploadStrategy::BufferSubData:
+		mode = StagingRing::Mode::BufferSubData;
+		break;
+	case UploadStrategy::Orphan:
+		mode = StagingRing::Mode::Orphan;
+		break;
+	case UploadStrategy::PersistentMap:
+		mode = StagingRing::Mode::Persistent;
+		break;
+	case UploadStrategy::Auto:
+	case UploadStrategy::MapUnsynchronized:
+		break;
+	}
+	const size_t row_bytes = size_t(tex_width) * sizeof(T);
+	if (ring.initialize(std::min(ring_frames * min_ring_rows * row_bytes, dataCount() * sizeof(T)), mode))
+	{
+		return true;
+	}
+	ring.destroy();
+	return false;
+}
+
+MatrixUploader::UploadStrategy MatrixUploader::calibrate()
+{
+	static std::mutex calibration_mutex;
+	static UploadStrategy calibrated = UploadStrategy::Auto;
+	std::lock_guard<std::mutex> lock(calibration_mutex);
+	if (calibrated != UploadStrategy::Auto)
+	{
+		return calibrated;
+	}
+
+	// rewriting the texture with the shadow's rows leaves it as it is
+	const Rect block{0, std::min(tex_height, int(min_ring_rows)), 0, tex_width};
+	glBindTexture(textureTarget(), textures[0].id);
+	double best_time = 0;
+	calibrated = UploadStrategy::MapUnsynchronized;
+	for (int i = int(UploadStrategy::Direct); i <= int(UploadStrategy::PersistentMap); ++i)
+	{
+		const UploadStrategy strategy = UploadStrategy(i);
+		if (!init_staging(strategy))
+		{
+			continue;
+		}
+		auto round = [this, &block] {
+			Rect r = block;
+			size_t staged = 0;
+			stage_rect(r, staged);
+			if (ring.isInitialized())
+				ring.fence();
+		};
+
+		// one round to warm up, then the timed ones until the GPU is done with them
+		round();
+		glFinish();
+		timer.start();
+		for (int n = 0; n < calibration_rounds; ++n)
+		{
+			round();
+		}
+		glFinish();
+		const double time = timer.nsecsElapsed() * 1e-9 / calibration_rounds;
+		ring.destroy();
+
+		std::cout << "Upload strategy " << strategyName(strategy) << ": " << time * 1e3 << "ms per " << block.row_end
+				  << " rows\n";
+		if (best_time == 0 || time < best_time)
+		{
+			best_time = time;
+			calibrated = strategy;
+		}
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glBindTexture(textureTarget(), 0);
+	std::cout << "Uploading " << strategyName(calibrated) << "\n";
+	return calibrated;
+}
+
+bool MatrixUploader::stage_rect(Rect& r, size_t& staged)
+{
+	const size_t width = r.col_end - r.col_begin;
+	const size_t row_bytes = width * sizeof(T);
+	// the rectangle in texels; r covers whole texels
+	const int x = r.col_begin / n_components;
+	const int texels = int(width) / n_components;
+	const GLenum pixels = pixelFormat();
+	if (upload_strategy.load(std::memory_order_relaxed) == UploadStrategy::Direct)
+	{
+		// the driver copies out of the shadow before glTexSubImage returns
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, texelColumnCount());
+		for (int row = r.row_begin; row < r.row_end;)
+		{
+			const int layer = row / tex_height;
+			const int end = std::min(r.row_end, (layer + 1) * tex_height);
+			const T* src = &shadow[size_t(row) * tex_width + r.col_begin];
+			if (n_layers == 1)
+				glTexSubImage2D(GL_TEXTURE_2D, 0, x, row, texels, end - row, pixels, GL_FLOAT, src);
+			else
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, x, row - layer * tex_height, layer, texels, end - row, 1,
+						pixels, GL_FLOAT, src);
+			row = end;
+		}
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		return true;
+	}
+
+	const int ring_rows = int(ring.capacity() / row_bytes);
+	for (int row = r.row_begin; row < r.row_end;)
+	{
+		// in parts which fit the ring and don't cross layers
+		const int layer = row / tex_height;
+		const int end = std::min({r.row_end, (layer + 1) * tex_height, row + ring_rows});
+		const size_t bytes = (end - row) * row_bytes;
+		size_t offset = 0;
+		auto* ptr = static_cast<T*>(ring.map(bytes, offset));
+		if (!ptr)
+		{
+			r.row_begin = row;
+			return false;
+		}
+		for (int i = row; i < end; ++i)
+		{
+			memcpy(ptr + (i - row) * width, &shadow[size_t(i) * tex_width + r.col_begin], row_bytes);
+		}
+		ring.unmap();
+
+		// the rows are packed in the ring, at the width of the rectangle
+		if (n_layers == 1)
+			glTexSubImage2D(GL_TEXTURE_2D, 0, x, row, texels, end - row, pixels, GL_FLOAT,
+					reinterpret_cast<const void*>(offset));
+		else
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, x, row - layer * tex_height, layer, texels, end - row, 1, pixels,
+					GL_FLOAT, reinterpret_cast<const void*>(offset));
+		staged += bytes;
+		row = end;
+	}
+	return true;
+}
+
+void MatrixUploader::mark_dirty(const Rect& r)
+{
+	for (auto& slot : textures)
+	{
+		std::vector<Rect>& dirty = slot.dirty;
+		dirty.insert(std::upper_bound(dirty.begin(), dirty.end(), r,
+							 [](const Rect& a, const Rect& b) { return a.row_begin < b.row_begin; }),
+				r);
+		if (dirty.size() <= max_dirty_rects)
+			continue;
+
+		// merge the neighbours with the fewest rows between them (overlapping ones first)
+		size_t best = 0;
+		for (size_t i = 1; i + 1 < dirty.size(); ++i)
+		{
+			if (dirty[i + 1].row_begin - dirty[i].row_end < dirty[best + 1].row_begin - dirty[best].row_end)
+				best = i;
+		}
+		Rect& a = dirty[best];
+		const Rect& b = dirty[best + 1];
+		a.row_end = std::max(a.row_end, b.row_end);
+		a.col_begin = std::min(a.col_begin, b.col_begin);
+		a.col_end = std::max(a.col_end, b.col_end);
+		dirty.erase(dirty.begin() + best + 1);
+	}
+}
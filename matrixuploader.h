@@ -0,0 +1,492 @@
+#ifndef MATRIXUPLOADER_H
+#define MATRIXUPLOADER_H
+
+#include <QElapsedTimer>
+#include <QOpenGLExtraFunctions>
+
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <lockfree_q/readerwriterqueue.h>
+
+#include "intensitystats.h"
+#include "rowcodec.h"
+#include "rowrecorder.h"
+#include "stagingring.h"
+
+/* Ingest queues and GPU upload stage of one matrix.
+ *
+ * With more than one layer, the matrix is a stack of equally sized layers,
+ * kept in one GL_TEXTURE_2D_ARRAY. Producers address the stack by row like
+ * a single matrix: layer l holds the rows
+ * [l * layerRowCount(), (l + 1) * layerRowCount()).
+ *
+ * With two components, the matrix holds complex samples: a row is
+ * columnCount() values of interleaved I/Q pairs, kept in an RG texture of
+ * columnCount() / 2 texels per row. The display derives what it shows from
+ * the pair, so producers needn't.
+ *
+ * Producers fill the queues from any thread. upload() runs with a GL context
+ * current, either the one of the displaying widget or the shared background
+ * context of UploadContext; it drains the queues into a shadow copy of the
+ * matrix in CPU memory and streams the rectangles the texture misses from
+ * there into the texture. The displaying context then samples the texture
+ * between acquire_texture() and release_texture().
+ *
+ * When uploaded from another context, the uploader keeps three textures and
+ * fences, so the background context always has one to write which isn't
+ * published or being sampled.
+ *
+ * Transfers are staged in a StagingRing sized for ring_frames uploads of the
+ * rows written per upload, which grows on bursts; larger rectangles are
+ * streamed through it in parts. Except with IngestPolicy::Unbounded, the
+ * queue of a channel holds at most queue_frames times its rows.
+ *
+ * Rows which are mostly one background value (e.g. zero around a peak) are
+ * queued as a SparseRow: either written so by the producer, or converted in
+ * insert() when at most sparseFill() of the row would need storing. They are
+ * expanded into the shadow matrix when drained.
+ *
+ * Data arriving column by column (e.g. one pulse across all range gates)
+ * is given to append_columns(), which transposes each block of columns
+ * into one row-major rectangle entry instead of a write per row.
+ *
+ * When the context is re-created (e.g. the widget docked or undocked),
+ * initialize() creates the textures from the shadow matrix, so the display
+ * continues where it left off instead of starting black.
+ */
+class MatrixUploader : protected QOpenGLExtraFunctions
+{
+public:
+	using T = float;
+	using Row = std::vector<T>;
+	using RowPtr = std::shared_ptr<Row>;
+
+	/// A whole row of background values, overwritten by runs of explicit values
+	using SparseRow = rowcodec::SparseRow;
+	using SparseRowPtr = std::shared_ptr<const SparseRow>;
+
+	/// What happens to writes while the queues are full, e.g. while the widget isn't painted
+	enum class IngestPolicy
+	{
+		Unbounded,      ///< the queues grow as needed
+		DropNewest,     ///< writes that don't fit are dropped
+		CollapseLatest, ///< writes that don't fit are kept per row, a whole row replacing earlier ones
+		DrainToShadow,  ///< drain_to_shadow() moves the queued writes into a CPU copy of the matrix
+	};
+
+	/// How rows get from the shadow matrix into the texture, see StagingRing::Mode
+	enum class UploadStrategy
+	{
+		Auto,              ///< the fastest in a calibration at the first initialize()
+		Direct,            ///< glTexSubImage from client memory, no staging buffer
+		BufferSubData,
+		Orphan,
+		MapUnsynchronized,
+		PersistentMap,
+	};
+	static const char* strategyName(UploadStrategy strategy);
+
+	/// components 2 for complex samples; cols counts texels, i.e. I/Q pairs then
+	MatrixUploader(int rows, int cols, int layers = 1, int components = 1);
+	~MatrixUploader();
+
+	size_t dataCount() const { return size_t(tex_width) * rowCount(); }
+	/// Rows of all layers
+	int rowCount() const { return tex_height * n_layers; }
+	/// Values per row, both of each pair with two components
+	int columnCount() const { return tex_width; }
+	/// 1, or 2 for interleaved I/Q
+	int componentCount() const { return n_components; }
+	/// Texels per row
+	int texelColumnCount() const { return tex_width / n_components; }
+	int layerCount() const { return n_layers; }
+	int layerRowCount() const { return tex_height; }
+	/// GL_TEXTURE_2D, or GL_TEXTURE_2D_ARRAY with several layers
+	GLenum textureTarget() const { return n_layers > 1 ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D; }
+
+	/// Next row of the matrix, wrapping around at the end
+	void append(Row input) { append(*channels[0], std::move(input)); }
+
+	/// Overwrite row pos of the matrix
+	bool insert(int pos, Row input) { return insert(*channels[0], pos, std::move(input)); }
+
+	/// Overwrite the columns [col_begin, col_begin + band.size()) of row pos
+	bool update_band(int pos, int col_begin, Row band) { return update_band(*channels[0], pos, col_begin, std::move(band)); }
+
+	/// Like append() and insert(), for rows already in sparse form
+	void append_sparse(SparseRow input) { append_sparse(*channels[0], std::move(input)); }
+	bool insert_sparse(int pos, SparseRow input) { return insert_sparse(*channels[0], pos, std::move(input)); }
+
+	/* Next n columns of the matrix, wrapping around at the last column;
+	 * columns holds n * rowCount() values, one column after the other.
+	 * Single component matrices only.
+	 */
+	void append_columns(const T* columns, int n) { append_columns(*channels[0], columns, n); }
+
+private:
+	struct Channel;
+
+public:
+	/* Handle for an additional producer thread.
+	 *
+	 * append()/insert() of the uploader itself may only be called from one
+	 * thread. Every further thread gets a Producer with a queue of its own,
+	 * which the upload stage merges, so producers never contend. A producer
+	 * owns the rows [rowBegin(), rowEnd()); its append() wraps around within
+	 * that range.
+	 */
+	class Producer
+	{
+	public:
+		Producer() = default;
+
+		bool isValid() const { return c != nullptr; }
+		int rowBegin() const { return c->row_begin; }
+		int rowEnd() const { return c->row_end; }
+		int columnCount() const { return u->columnCount(); }
+
+		void append(Row input) { u->append(*c, std::move(input)); }
+		bool insert(int pos, Row input) { return u->insert(*c, pos, std::move(input)); }
+		bool update_band(int pos, int col_begin, Row band) { return u->update_band(*c, pos, col_begin, std::move(band)); }
+		void append_sparse(SparseRow input) { u->append_sparse(*c, std::move(input)); }
+		bool insert_sparse(int pos, SparseRow input) { return u->insert_sparse(*c, pos, std::move(input)); }
+		/// Columns of the producer's rows, rowEnd() - rowBegin() values each
+		void append_columns(const T* columns, int n) { u->append_columns(*c, columns, n); }
+
+	private:
+		friend class MatrixUploader;
+		Producer(MatrixUploader* uploader, Channel* channel)
+			: u(uploader)
+			, c(channel)
+		{
+		}
+
+		MatrixUploader* u = nullptr;
+		Channel* c = nullptr;
+	};
+
+	/// Thread-safe; the returned handle is invalid if the range is empty or all channels are taken
+	Producer add_producer(int row_begin, int row_end);
+
+	/// Tee every inserted row to a recorder; set before rows are inserted
+	void set_recorder(std::shared_ptr<RowRecorder> r);
+
+	/// Set before rows are inserted
+	void set_ingest_policy(IngestPolicy policy) { ingest_policy = policy; }
+	IngestPolicy ingestPolicy() const { return ingest_policy; }
+	/* For DrainToShadow: while nothing is uploaded, moves the queued writes
+	 * into the shadow matrix; the next upload copies them into the texture.
+	 * Needs no context. Returns the writes drained.
+	 */
+	size_t drain_to_shadow();
+
+	/* Whole rows given to insert() are queued as a SparseRow of background
+	 * zero when its runs and values take at most this fraction of the row's
+	 * values; 0 queues them as given. Set before rows are inserted.
+	 */
+	void set_sparse_fill(float max_fill) { sparse_fill = max_fill; }
+	float sparseFill() const { return sparse_fill; }
+	/// Rows queued as a SparseRow since construction
+	long sparseRows() const { return sparse_rows.load(std::memory_order_relaxed); }
+
+	/// Writes lost to full queues, replaced in the overflow and drained off-screen, since construction
+	long droppedRows() const { return dropped_rows.load(std::memory_order_relaxed); }
+	long collapsedRows() const { return collapsed_rows.load(std::memory_order_relaxed); }
+	long drainedRows() const { return drained_rows.load(std::memory_order_relaxed); }
+	/// Writes waiting in the queues of all producers; approximate while they are being filled
+	size_t queuedWrites() const;
+
+	/// Collect intensity statistics on the producer threads, as rows are queued
+	void set_stats_enabled(bool enabled) { stats_enabled.store(enabled, std::memory_order_relaxed); }
+	/// Statistics of recent rows of all producers, with the quantiles low_q and high_q
+	IntensitySummary intensitySummary(float low_q, float high_q);
+
+	/* GL side; the calls below need a context of the share group current */
+
+	/// Set before initialize()
+	void set_upload_strategy(UploadStrategy strategy) { wanted_strategy = strategy; }
+	/// The strategy in use, Auto before initialize()
+	UploadStrategy uploadStrategy() const { return upload_strategy.load(std::memory_order_relaxed); }
+
+	/// Creates the textures and the staging ring; shared = uploaded from another context than the one sampling
+	void initialize(bool shared);
+	void destroy();
+	bool isInitialized() const { return initialized.load(std::memory_order_acquire); }
+
+	/// Drains the queues into the shadow matrix and copies what a texture misses into it
+	void upload();
+
+	/// CPU time of the last initialize(), including filling the textures from the shadow matrix
+	/// and, the first time, the strategy calibration, in s
+	double initTime() const { return init_time.load(std::memory_order_relaxed); }
+
+	struct TextureView
+	{
+		GLuint id;
+		bool mipmapped;
+		bool filterable; ///< may be sampled with GL_LINEAR
+	};
+
+	/// Latest uploaded texture; waits (on the GPU) for its upload to finish
+	TextureView acquire_texture();
+	/// Call after the draw calls sampling the acquired texture
+	void release_texture();
+
+	/// Generate mip levels along with the uploads, for zoomed out views
+	void set_mipmaps_wanted(bool wanted) { mipmaps_wanted.store(wanted, std::memory_order_relaxed); }
+	/* The textures will be sampled with linear filtering. Where R32F isn't
+	 * filterable (OpenGL ES without OES_texture_float_linear), they are
+	 * switched to R16F, one by one as they are written next.
+	 */
+	void set_filtering_wanted(bool wanted) { filtering_wanted.store(wanted, std::memory_order_relaxed); }
+	int maxLod() const { return max_lod; }
+
+	/// Smoothed CPU time of staging into the texture (copy) and of draining the queues (upload) in s
+	double copyTime() const { return copy_time.load(std::memory_order_relaxed); }
+	double uploadTime() const { return upload_time.load(std::memory_order_relaxed); }
+	/// Smoothed writes drained and texture rectangles copied per upload
+	double uploadRows() const { return upload_rows.load(std::memory_order_relaxed); }
+	double uploadRanges() const { return upload_ranges.load(std::memory_order_relaxed); }
+	/// Size of the staging ring in bytes, and the smoothed time an upload waited for it in s
+	size_t stagingBytes() const { return staging_bytes.load(std::memory_order_relaxed); }
+	double stagingWaitTime() const { return staging_wait.load(std::memory_order_relaxed); }
+
+	/// For UploadContext: set by the displaying widget, cleared by the upload
+	std::atomic<bool> upload_requested;
+
+private:
+	MatrixUploader(const MatrixUploader&) = delete;
+	MatrixUploader& operator=(const MatrixUploader&) = delete;
+
+	struct Entry
+	{
+		int matrix_row;
+		int col_begin; ///< values covers [col_begin, col_begin + values->size() / rows)
+		RowPtr values;
+		SparseRowPtr sparse; ///< instead of values, for the whole row
+		int rows = 1;        ///< of values, row-major, starting at matrix_row
+	};
+	int entryEnd(const Entry& e) const { return e.sparse ? tex_width : e.col_begin + int(e.values->size()) / e.rows; }
+	using LockFreeQueue = moodycamel::ReaderWriterQueue<Entry>;
+
+	/// Queue capacity in multiples of the rows of a channel
+	static constexpr int queue_frames = 2;
+	/// CollapseLatest keeps at most this many band writes per row on top of a whole row
+	static constexpr size_t max_pending_bands = 8;
+
+	/// The queue of one producer
+	struct Channel
+	{
+		Channel(int row_begin, int row_end)
+			: row_begin(row_begin)
+			, row_end(row_end)
+			, append_pos(row_begin)
+			, append_col(0)
+			, input_q(size_t(queue_frames) * (row_end - row_begin))
+			, recorder_port(nullptr)
+			, overflowing(false)
+		{
+		}
+
+		int row_begin;
+		int row_end;
+		int append_pos; ///< next append position, owned by the producer
+		int append_col; ///< next append_columns() position, owned by the producer
+		LockFreeQueue input_q;
+		RowRecorder::Port* recorder_port;
+
+		/* CollapseLatest: once the queue is full, the producer writes here
+		 * until the consumer has taken the overflow, so all of it is newer
+		 * than what is queued.
+		 */
+		std::vector<std::vector<Entry>> overflow; ///< per row of the channel, allocated on first use
+		std::vector<int> overflow_rows;           ///< rows with writes in overflow
+		std::atomic<bool> overflowing;
+		std::mutex overflow_mutex;
+
+		IntensitySketch stats;
+		std::mutex stats_mutex; ///< only contended while a summary is taken
+	};
+
+	void append(Channel& c, Row input)
+	{
+		insert(c, c.append_pos, std::move(input));
+		c.append_pos = (c.append_pos + 1 == c.row_end) ? c.row_begin : c.append_pos + 1;
+	}
+
+	bool insert(Channel& c, int pos, Row input)
+	{
+		assert(int(input.size()) == tex_width);
+		return update_band(c, pos, 0, std::move(input));
+	}
+
+	void append_sparse(Channel& c, SparseRow input)
+	{
+		insert_sparse(c, c.append_pos, std::move(input));
+		c.append_pos = (c.append_pos + 1 == c.row_end) ? c.row_begin : c.append_pos + 1;
+	}
+
+	bool insert_sparse(Channel& c, int pos, SparseRow input);
+
+	void append_columns(Channel& c, const T* columns, int n);
+
+	bool update_band(Channel& c, int pos, int col_begin, Row band)
+	{
+		if (pos < c.row_begin || pos >= c.row_end || col_begin < 0 || band.empty() ||
+				col_begin + int(band.size()) > tex_width || col_begin % n_components || band.size() % n_components)
+		{
+			return false;
+		}
+		const bool full_row = int(band.size()) == tex_width;
+		if (stats_enabled.load(std::memory_order_relaxed))
+		{
+			std::lock_guard<std::mutex> lock(c.stats_mutex);
+			c.stats.add(band.data(), band.size());
+		}
+		if (full_row && sparse_fill > 0.f)
+		{
+			SparseRow sparse;
+			if (rowcodec::sparsify(band, T(0), size_t(sparse_fill * tex_width), sparse))
+			{
+				// the recording format holds dense rows
+				if (c.recorder_port)
+				{
+					recorder->push(c.recorder_port, pos, 0, std::make_shared<Row>(std::move(band)));
+				}
+				sparse_rows.fetch_add(1, std::memory_order_relaxed);
+				return queue_entry(c, Entry{pos, 0, nullptr, std::make_shared<const SparseRow>(std::move(sparse))});
+			}
+		}
+		auto input_ptr = std::make_shared<Row>(std::move(band));
+		if (c.recorder_port)
+		{
+			recorder->push(c.recorder_port, pos, col_begin, input_ptr);
+		}
+		return queue_entry(c, Entry{pos, col_begin, std::move(input_ptr), nullptr});
+	}
+
+	/// Queues per the ingest policy; false if the write was dropped
+	bool queue_entry(Channel& c, Entry e);
+	/// CollapseLatest: keeps a single row write in the overflow, with overflow_mutex held
+	bool overflow_entry(Channel& c, Entry e);
+	/// Appends the queued writes of all channels, for each channel in the order written
+	void drain_queues(std::vector<Entry>& entries);
+	void apply_to_shadow(const std::vector<Entry>& entries);
+
+	void initTextures();
+	struct Rect
+	{
+		int row_begin;
+		int row_end;
+		int col_begin;
+		int col_end;
+	};
+
+	/// Drains the queues into the shadow matrix and marks what they wrote dirty; returns the writes
+	size_t consume_queues();
+	/* Streams a rectangle of the shadow matrix through the ring into the
+	 * bound texture, adding the bytes staged to staged. False if the ring
+	 * couldn't be mapped; r then holds the rows not staged.
+	 */
+	bool stage_rect(Rect& r, size_t& staged);
+	/// Sets up the ring for the strategy; false if the context doesn't support it
+	bool init_staging(UploadStrategy strategy);
+	/// Times each strategy on the first texture, once per process; the driver is the same for all widgets
+	UploadStrategy calibrate();
+	static constexpr int calibration_rounds = 16;
+
+	int tex_width;  ///< values per row, n_components per texel
+	int tex_height; ///< rows of one layer
+	int n_layers;
+	int n_components;
+
+	/// GL_RED or GL_RG, of floats
+	GLenum pixelFormat() const { return n_components == 2 ? GL_RG : GL_RED; }
+	/// GL_R32F or GL_RG32F; half for the 16 bit variant
+	GLenum internalFormat(bool half) const
+	{
+		if (n_components == 2)
+			return half ? GL_RG16F : GL_RG32F;
+		return half ? GL_R16F : GL_R32F;
+	}
+
+	static constexpr size_t max_channels = 64;
+
+	/* Channels are only ever added, so the consumer can walk the first
+	 * n_channels without locking; channel 0 serves append()/insert().
+	 */
+	std::array<std::unique_ptr<Channel>, max_channels> channels;
+	std::atomic<size_t> n_channels;
+	std::mutex channels_mutex; ///< serializes add_producer()
+	std::shared_ptr<RowRecorder> recorder;
+	std::atomic<bool> stats_enabled;
+
+	IngestPolicy ingest_policy;
+	float sparse_fill;
+	std::atomic<long> sparse_rows;
+	std::atomic<long> dropped_rows;
+	std::atomic<long> collapsed_rows;
+	std::atomic<long> drained_rows;
+
+	/// Serializes draining the queues; guards the shadow, the staging ring and the dirty rectangles
+	std::mutex consume_mutex;
+	std::vector<Entry> frame_entries; ///< writes drained by the current upload
+	std::vector<T> shadow;            ///< the matrix as of the writes drained so far
+
+	StagingRing ring; ///< unused by UploadStrategy::Direct
+	UploadStrategy wanted_strategy;
+	std::atomic<UploadStrategy> upload_strategy;
+	/// The ring holds this many uploads of the rows written per upload
+	static constexpr size_t ring_frames = 3;
+	/// Rows per upload the ring is sized for before it has seen a burst
+	static constexpr size_t min_ring_rows = 64;
+
+	struct TextureSlot
+	{
+		GLuint id;
+		GLenum format; ///< internalFormat(), 16 bit for filtering where 32 bit floats aren't filterable
+		bool mipmapped;
+		GLsync written; ///< signalled when the upload into the texture is done
+		GLsync sampled; ///< signalled when the draw reading the texture is done
+		std::vector<Rect> dirty; ///< where the texture differs from the shadow matrix, sorted by row
+	};
+
+	/// (Re)specifies the storage of the slot's texture, filled from the shadow matrix, and binds it
+	void allocate_storage(TextureSlot& slot, GLenum format, bool mipmapped);
+
+	/// Records a write for all textures; beyond max_dirty_rects, the closest rectangles are merged
+	void mark_dirty(const Rect& r);
+	static constexpr size_t max_dirty_rects = 32;
+
+	/// 1 slot when uploading in the sampling context, 3 otherwise
+	std::vector<TextureSlot> textures;
+	std::mutex textures_mutex; ///< guards the slot indices and fences below
+	int published;          ///< slot of the latest finished upload, -1 if none
+	int in_use;             ///< slot acquired for sampling, -1 if none
+	bool shared;
+
+	std::atomic<bool> initialized;
+	std::atomic<bool> mipmaps_wanted;
+	std::atomic<bool> filtering_wanted;
+	bool lod_supported; ///< R32F is filterable, so mipmaps can be generated
+	bool float_filterable;
+	bool texture_storage; ///< immutable textures; then a format change takes a new texture
+	int max_lod;
+
+	QElapsedTimer timer;
+	std::atomic<double> init_time;
+	std::atomic<double> upload_time;
+	std::atomic<double> copy_time;
+	std::atomic<double> upload_rows;
+	std::atomic<double> upload_ranges;
+	std::atomic<size_t> staging_bytes;
+	std::atomic<double> staging_wait;
+	long time_cnt;
+};
+
+#endif
@@ -0,0 +1,137 @@
+#include "realfft.h"
+
+#include <cassert>
+#include <cmath>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+RealFft::RealFft(int n)
+	: n(n)
+	, half(n / 2)
+	, bit_reversed(half)
+	, split_re(half)
+	, split_im(half)
+	, re(half)
+	, im(half)
+{
+	assert(n >= 8 && (n & (n - 1)) == 0);
+	int bits = 0;
+	while ((1 << bits) < half)
+		++bits;
+	for (int i = 0; i < half; ++i)
+	{
+		int r = 0;
+		for (int b = 0; b < bits; ++b)
+		{
+			if (i & (1 << b))
+				r |= 1 << (bits - 1 - b);
+		}
+		bit_reversed[i] = r;
+	}
+
+	const double pi = std::acos(-1.0);
+	for (int len = 8; len <= half; len *= 2)
+	{
+		for (int j = 0; j < len / 2; ++j)
+		{
+			twiddle_re.push_back(std::cos(-2 * pi * j / len));
+			twiddle_im.push_back(std::sin(-2 * pi * j / len));
+		}
+	}
+	for (int k = 0; k < half; ++k)
+	{
+		split_re[k] = std::cos(-2 * pi * k / n);
+		split_im[k] = std::sin(-2 * pi * k / n);
+	}
+}
+
+void RealFft::power(const float* in, float* out)
+{
+	float* zr = re.data();
+	float* zi = im.data();
+	for (int m = 0; m < half; ++m)
+	{
+		const int r = bit_reversed[m];
+		zr[r] = in[2 * m];
+		zi[r] = in[2 * m + 1];
+	}
+
+	// the stages of length 2 and 4 have twiddles 1 and -i, so they are done together without multiplications
+	for (int base = 0; base < half; base += 4)
+	{
+		float* r = zr + base;
+		float* i = zi + base;
+		const float sum0_re = r[0] + r[1], sum0_im = i[0] + i[1];
+		const float diff0_re = r[0] - r[1], diff0_im = i[0] - i[1];
+		const float sum1_re = r[2] + r[3], sum1_im = i[2] + i[3];
+		const float diff1_re = r[2] - r[3], diff1_im = i[2] - i[3];
+		r[0] = sum0_re + sum1_re;
+		i[0] = sum0_im + sum1_im;
+		r[2] = sum0_re - sum1_re;
+		i[2] = sum0_im - sum1_im;
+		// -i * diff1
+		r[1] = diff0_re + diff1_im;
+		i[1] = diff0_im - diff1_re;
+		r[3] = diff0_re - diff1_im;
+		i[3] = diff0_im + diff1_re;
+	}
+
+	// the others have a multiple of 4 butterflies per block
+	const float* wr = twiddle_re.data();
+	const float* wi = twiddle_im.data();
+	for (int len = 8; len <= half; len *= 2)
+	{
+		const int h = len / 2;
+		for (int base = 0; base < half; base += len)
+		{
+			float* ar = zr + base;
+			float* ai = zi + base;
+			float* br = ar + h;
+			float* bi = ai + h;
+#ifdef __SSE__
+			for (int j = 0; j < h; j += 4)
+			{
+				const __m128 w_re = _mm_loadu_ps(wr + j);
+				const __m128 w_im = _mm_loadu_ps(wi + j);
+				const __m128 b_re = _mm_loadu_ps(br + j);
+				const __m128 b_im = _mm_loadu_ps(bi + j);
+				const __m128 a_re = _mm_loadu_ps(ar + j);
+				const __m128 a_im = _mm_loadu_ps(ai + j);
+				const __m128 tr = _mm_sub_ps(_mm_mul_ps(w_re, b_re), _mm_mul_ps(w_im, b_im));
+				const __m128 ti = _mm_add_ps(_mm_mul_ps(w_re, b_im), _mm_mul_ps(w_im, b_re));
+				_mm_storeu_ps(br + j, _mm_sub_ps(a_re, tr));
+				_mm_storeu_ps(bi + j, _mm_sub_ps(a_im, ti));
+				_mm_storeu_ps(ar + j, _mm_add_ps(a_re, tr));
+				_mm_storeu_ps(ai + j, _mm_add_ps(a_im, ti));
+			}
+#else
+			for (int j = 0; j < h; ++j)
+			{
+				const float tr = wr[j] * br[j] - wi[j] * bi[j];
+				const float ti = wr[j] * bi[j] + wi[j] * br[j];
+				br[j] = ar[j] - tr;
+				bi[j] = ai[j] - ti;
+				ar[j] += tr;
+				ai[j] += ti;
+			}
+#endif
+		}
+		wr += h;
+		wi += h;
+	}
+
+	// Z_k = E_k + i O_k with E, O the spectra of the even and odd samples; X_k = E_k + e^(-2 pi i k / n) O_k
+	for (int k = 0; k < half; ++k)
+	{
+		const int m = k == 0 ? 0 : half - k;
+		const float even_re = 0.5f * (zr[k] + zr[m]);
+		const float even_im = 0.5f * (zi[k] - zi[m]);
+		const float odd_re = 0.5f * (zi[k] + zi[m]);
+		const float odd_im = -0.5f * (zr[k] - zr[m]);
+		const float x_re = even_re + split_re[k] * odd_re - split_im[k] * odd_im;
+		const float x_im = even_im + split_re[k] * odd_im + split_im[k] * odd_re;
+		out[k] = x_re * x_re + x_im * x_im;
+	}
+}
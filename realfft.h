@@ -0,0 +1,40 @@
+#ifndef REALFFT_H
+#define REALFFT_H
+
+#include <vector>
+
+/* Power spectrum of a real signal by FFT.
+ *
+ * The n real samples are transformed as n/2 complex ones (even samples real,
+ * odd ones imaginary) by an iterative radix-2 FFT, and the two interleaved
+ * half spectra are separated afterwards. Data is kept as separate real and
+ * imaginary arrays, so the butterflies of a stage run over contiguous
+ * elements, four at a time with SSE. The first two stages need no
+ * multiplications and are done in one pass.
+ */
+class RealFft
+{
+public:
+	/// n a power of two, at least 8
+	explicit RealFft(int n);
+
+	int size() const { return n; }
+
+	/// |X_k|^2 of the bins k < size() / 2 of the size() samples in
+	void power(const float* in, float* out);
+
+private:
+	int n;
+	int half; ///< points of the complex FFT
+	std::vector<int> bit_reversed;
+	/// e^(-2 pi i j / len) for j < len / 2, of each stage len = 8, 16, .. half in turn
+	std::vector<float> twiddle_re;
+	std::vector<float> twiddle_im;
+	/// e^(-2 pi i k / n) for k < half, to separate the half spectra
+	std::vector<float> split_re;
+	std::vector<float> split_im;
+	std::vector<float> re;
+	std::vector<float> im;
+};
+
+#endif
@@ -0,0 +1,197 @@
+#include "replaysource.h"
+#include "glwidget.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+std::shared_ptr<const MappedMatrixFile> MappedMatrixFile::open(const std::string& path)
+{
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		std::cerr << "Cannot open recording " << path << "\n";
+		return nullptr;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(matrixfile::Header))
+	{
+		std::cerr << "Recording " << path << " is too short\n";
+		::close(fd);
+		return nullptr;
+	}
+
+	void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd); // the mapping keeps the file referenced
+	if (addr == MAP_FAILED)
+	{
+		std::cerr << "Cannot map recording " << path << "\n";
+		return nullptr;
+	}
+
+	std::shared_ptr<MappedMatrixFile> f(new MappedMatrixFile);
+	f->data = static_cast<const unsigned char*>(addr);
+	f->size = st.st_size;
+	memcpy(&f->header, f->data, sizeof(matrixfile::Header));
+
+	std::string error;
+	if (!matrixfile::validate(f->header, f->data, f->size, error))
+	{
+		std::cerr << "Recording " << path << ": " << error << "\n";
+		return nullptr;
+	}
+
+	// records are read front to back, let the kernel read ahead
+	madvise(addr, f->size, MADV_SEQUENTIAL);
+	madvise(addr, f->size, MADV_WILLNEED);
+	return f;
+}
+
+MappedMatrixFile::~MappedMatrixFile()
+{
+	if (data)
+	{
+		munmap(const_cast<unsigned char*>(data), size);
+	}
+}
+
+bool MappedMatrixFile::read_record(size_t& offset, matrixfile::Record& r, float* out) const
+{
+	const unsigned char* src;
+	if (!matrixfile::next_record(header, data, size, offset, r, src))
+	{
+		return false;
+	}
+	const size_t n = r.count;
+
+	auto convert = [n, src, out](auto tag) {
+		using Sample = decltype(tag);
+		Sample s;
+		for (size_t i = 0; i < n; ++i)
+		{
+			memcpy(&s, src + i * sizeof(Sample), sizeof(Sample)); // the mapping may be unaligned
+			out[i] = static_cast<float>(s);
+		}
+	};
+
+	switch (static_cast<matrixfile::DType>(header.dtype))
+	{
+	case matrixfile::DType::Float32:
+		memcpy(out, src, n * sizeof(float));
+		break;
+	case matrixfile::DType::Float64:
+		convert(double());
+		break;
+	case matrixfile::DType::Int16:
+		convert(int16_t());
+		break;
+	case matrixfile::DType::UInt16:
+		convert(uint16_t());
+		break;
+	}
+	return true;
+}
+
+ReplaySource::ReplaySource(GLWidget* widget, std::shared_ptr<const MappedMatrixFile> file, double rate)
+	: w(widget)
+	, file(std::move(file))
+	, rate(rate)
+	, stop(false)
+{
+}
+
+ReplaySource::~ReplaySource()
+{
+	stop.store(true);
+	if (thread.joinable())
+	{
+		thread.join();
+	}
+}
+
+void ReplaySource::start()
+{
+	thread = std::thread([this] { run(); });
+}
+
+void ReplaySource::run()
+{
+	using namespace std::chrono;
+
+	const bool paced = rate > 0;
+	const auto period = paced ? duration_cast<steady_clock::duration>(duration<double>(1.0 / rate)) : steady_clock::duration(0);
+
+	auto deadline = steady_clock::now();
+	auto report_start = deadline;
+	long n_count = 0;
+	size_t idx = 0;
+	size_t offset = file->first_record();
+	matrixfile::Record r;
+
+	// unpaced, wait for the widget to take the rows instead of queueing the recording
+	const size_t max_queued = w->rowCount();
+
+	while (!stop.load(std::memory_order_relaxed))
+	{
+		if (!paced && w->queuedWrites() >= max_queued)
+		{
+			std::this_thread::sleep_for(milliseconds(1));
+			continue;
+		}
+
+		if (idx == file->row_count())
+		{
+			idx = 0;
+			offset = file->first_record();
+		}
+		// the row is handed over by move, so the mapping is read exactly once per record
+		GLWidget::Row values(file->cols());
+		if (!file->read_record(offset, r, values.data()))
+		{
+			// validated up to row_count() only when the writer didn't finish
+			if (idx == 0)
+			{
+				std::cerr << "Replay: recording has no valid records\n";
+				return;
+			}
+			idx = file->row_count();
+			continue;
+		}
+		++idx;
+		values.resize(r.count);
+		if (r.count == file->cols())
+			w->insert(r.row, std::move(values));
+		else
+			w->update_band(r.row, r.col_begin, std::move(values));
+
+		if (++n_count % 10000 == 0)
+		{
+			auto now = steady_clock::now();
+			double s = duration<double>(now - report_start).count();
+			if (s > 0)
+			{
+				std::cerr << "Replay DPS: " << n_count / s << "\n";
+			}
+			n_count = 0;
+			report_start = now;
+		}
+
+		if (paced)
+		{
+			// sleep to absolute deadlines, so the rate doesn't drift with the append time
+			deadline += period;
+			// in slices, so a slow rate doesn't hold up stopping
+			while (!stop.load(std::memory_order_relaxed) && steady_clock::now() < deadline)
+			{
+				std::this_thread::sleep_until(std::min(deadline, steady_clock::now() + milliseconds(100)));
+			}
+		}
+	}
+}
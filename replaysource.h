@@ -0,0 +1,71 @@
+#ifndef REPLAYSOURCE_H
+#define REPLAYSOURCE_H
+
+#include "matrixfile.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+class GLWidget;
+
+/// Read-only memory mapping of a recorded row stream
+class MappedMatrixFile
+{
+public:
+	static std::shared_ptr<const MappedMatrixFile> open(const std::string& path);
+	~MappedMatrixFile();
+
+	size_t rows() const { return header.rows; }
+	/// Values per row, components() per column
+	size_t cols() const { return header.cols; }
+	/// 2 for I/Q pairs
+	int components() const { return header.components; }
+	/// Records, each a row or part of one
+	size_t row_count() const { return header.row_count; }
+
+	/// Offset of the first record
+	size_t first_record() const { return header.data_offset; }
+	/* Copies the samples of the record at offset into out (room for cols()
+	 * samples), converting to float, and advances offset to the next record.
+	 * False if there is no valid record at offset.
+	 */
+	bool read_record(size_t& offset, matrixfile::Record& r, float* out) const;
+
+private:
+	MappedMatrixFile() = default;
+	MappedMatrixFile(const MappedMatrixFile&) = delete;
+	MappedMatrixFile& operator=(const MappedMatrixFile&) = delete;
+
+	matrixfile::Header header;
+	const unsigned char* data = nullptr;
+	size_t size = 0;
+};
+
+/// Writes the records of a recording into a widget where they were written, looping at the end
+class ReplaySource
+{
+public:
+	/// rate in rows/s; 0 replays as fast as the widget accepts rows
+	ReplaySource(GLWidget* widget, std::shared_ptr<const MappedMatrixFile> file, double rate);
+	/// Stops the replay thread and waits for it, the widget must outlive this
+	~ReplaySource();
+
+	void start();
+
+private:
+	ReplaySource(const ReplaySource&) = delete;
+	ReplaySource& operator=(const ReplaySource&) = delete;
+
+	void run();
+
+	GLWidget* w;
+	std::shared_ptr<const MappedMatrixFile> file;
+	double rate;
+
+	std::atomic<bool> stop;
+	std::thread thread;
+};
+
+#endif
@@ -0,0 +1,125 @@
+#include "rowcodec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+namespace rowcodec
+{
+
+namespace
+{
+/// [begin, end) of the next run at or after i, bridging gaps of up to max_gap background values; begin == n if none
+std::pair<int, int> next_run(const float* row, int n, int i, float background, int max_gap)
+{
+	while (i < n && row[i] == background)
+		++i;
+	int end = std::min(i + 1, n);
+	for (int j = end; j < n && j - end < max_gap; ++j)
+	{
+		if (row[j] != background)
+			end = j + 1;
+	}
+	return std::make_pair(i, end);
+}
+} // namespace
+
+bool sparsify(const std::vector<float>& row, float background, size_t budget, SparseRow& out)
+{
+	const int n = int(row.size());
+	const size_t run_cost = sizeof(SparseRow::Run) / sizeof(float);
+
+	// count first, so rows which turn out dense cost no allocations
+	size_t n_runs = 0;
+	size_t n_values = 0;
+	for (auto run = next_run(row.data(), n, 0, background, run_merge_gap); run.first < n;
+			run = next_run(row.data(), n, run.second, background, run_merge_gap))
+	{
+		++n_runs;
+		n_values += run.second - run.first;
+		if (n_runs * run_cost + n_values > budget)
+			return false;
+	}
+
+	out.background = background;
+	out.runs.clear();
+	out.runs.reserve(n_runs);
+	out.values.clear();
+	out.values.reserve(n_values);
+	for (auto run = next_run(row.data(), n, 0, background, run_merge_gap); run.first < n;
+			run = next_run(row.data(), n, run.second, background, run_merge_gap))
+	{
+		out.runs.push_back(SparseRow::Run{run.first, run.second - run.first});
+		out.values.insert(out.values.end(), row.begin() + run.first, row.begin() + run.second);
+	}
+	return true;
+}
+
+void expand(const SparseRow& row, float* dense, int cols)
+{
+	std::fill(dense, dense + cols, row.background);
+	const float* values = row.values.data();
+	for (const SparseRow::Run& run : row.runs)
+	{
+		memcpy(dense + run.col_begin, values, run.count * sizeof(float));
+		values += run.count;
+	}
+}
+
+void transpose(const float* columns, int n, int rows, float* block)
+{
+	for (int r0 = 0; r0 < rows; r0 += transpose_tile)
+	{
+		const int r1 = std::min(r0 + transpose_tile, rows);
+		for (int c0 = 0; c0 < n; c0 += transpose_tile)
+		{
+			const int c1 = std::min(c0 + transpose_tile, n);
+			int r = r0;
+#ifdef __SSE__
+			// 4x4 blocks in registers: four column loads become four row stores
+			for (; r + 4 <= r1; r += 4)
+			{
+				int col = c0;
+				for (; col + 4 <= c1; col += 4)
+				{
+					const float* in = columns + size_t(col) * rows + r;
+					__m128 a = _mm_loadu_ps(in);
+					__m128 b = _mm_loadu_ps(in + rows);
+					__m128 c = _mm_loadu_ps(in + 2 * size_t(rows));
+					__m128 d = _mm_loadu_ps(in + 3 * size_t(rows));
+					_MM_TRANSPOSE4_PS(a, b, c, d);
+					float* out = block + size_t(r) * n + col;
+					_mm_storeu_ps(out, a);
+					_mm_storeu_ps(out + n, b);
+					_mm_storeu_ps(out + 2 * size_t(n), c);
+					_mm_storeu_ps(out + 3 * size_t(n), d);
+				}
+				for (; col < c1; ++col)
+				{
+					for (int i = r; i < r + 4; ++i)
+						block[size_t(i) * n + col] = columns[size_t(col) * rows + i];
+				}
+			}
+#endif
+			for (; r < r1; ++r)
+			{
+				for (int col = c0; col < c1; ++col)
+					block[size_t(r) * n + col] = columns[size_t(col) * rows + r];
+			}
+		}
+	}
+}
+
+void write_block(const float* block, int rows, int n, float* matrix, int width, int row_begin, int col_begin)
+{
+	for (int r = 0; r < rows; ++r)
+	{
+		memcpy(matrix + size_t(row_begin + r) * width + col_begin, block + size_t(r) * n, n * sizeof(float));
+	}
+}
+
+} // namespace rowcodec
@@ -0,0 +1,47 @@
+#ifndef ROWCODEC_H
+#define ROWCODEC_H
+
+#include <cstddef>
+#include <vector>
+
+/* CPU side conversions of rows on the ingest path, kept free of GL so they
+ * can be checked and timed on their own.
+ */
+namespace rowcodec
+{
+
+/// A whole row of background values, overwritten by runs of explicit values
+struct SparseRow
+{
+	struct Run
+	{
+		int col_begin;
+		int count;
+	};
+
+	float background = 0.f;
+	std::vector<Run> runs;     ///< ascending and disjoint
+	std::vector<float> values; ///< of all runs, back to back
+};
+
+/// Background gaps of up to this many values are bridged, they cost less than a new run
+constexpr int run_merge_gap = int(sizeof(SparseRow::Run) / sizeof(float));
+
+/* Encodes the values other than background as runs, bridging gaps of up
+ * to run_merge_gap background values. False as soon as the runs and values
+ * would take more than budget values, the row is then better queued dense.
+ */
+bool sparsify(const std::vector<float>& row, float background, size_t budget, SparseRow& out);
+/// Writes the sparse row over a dense one of cols values
+void expand(const SparseRow& row, float* dense, int cols);
+
+/// Square tiles of the transpose, sized so a tile of input and output stays in L1
+constexpr int transpose_tile = 32;
+/// Transposes n columns of rows values each into a row-major rows x n block
+void transpose(const float* columns, int n, int rows, float* block);
+/// Copies a row-major rows x n block into a matrix of width values per row, at row_begin and col_begin
+void write_block(const float* block, int rows, int n, float* matrix, int width, int row_begin, int col_begin);
+
+} // namespace rowcodec
+
+#endif
@@ -0,0 +1,248 @@
+/* Checks and timings of the ingest path's row conversions.
+ *
+ * Sparse rows: encodes random rows of varying density and background with
+ * sparsify(), expands them again and compares with the input, including
+ * rows over the budget, which must be refused. Then times encoding,
+ * expansion and the intensity statistics of a row shaped like the load
+ * generator's, an 80 value peak in zeros, against its dense counterpart.
+ *
+ * Column blocks: compares the blocked transpose with a scalar one for all
+ * shapes up to 70 x 70, i.e. across the 4 x 4 register blocks and 32 x 32
+ * tiles, and appends columns the way append_columns() does, into bands not
+ * starting at row 0 and wrapping at the last column, against element wise
+ * writes. Then times both transposes for a few producer shapes.
+ *
+ * Usage: rowcodec_bench [columns] [rounds]
+ */
+#include "intensitystats.h"
+#include "rowcodec.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+namespace
+{
+using clock = std::chrono::steady_clock;
+
+double seconds_since(clock::time_point t0) { return std::chrono::duration<double>(clock::now() - t0).count(); }
+
+/// Round trips of random rows through sparsify() and expand()
+bool check_sparse(std::mt19937& g)
+{
+	std::uniform_real_distribution<float> uniform(0.f, 1.f);
+	for (int round = 0; round < 2000; ++round)
+	{
+		const int cols = 1 + g() % 300;
+		const float background = round % 2 ? 0.f : 3.5f;
+		const float density = uniform(g) * uniform(g);
+		std::vector<float> row(cols, background);
+		for (float& v : row)
+		{
+			if (uniform(g) < density)
+				v = uniform(g);
+		}
+		const size_t budget = g() % (cols + 1);
+
+		rowcodec::SparseRow sparse;
+		const bool encoded = rowcodec::sparsify(row, background, budget, sparse);
+		size_t stored = 0;
+		int non_background = 0;
+		for (float v : row)
+			non_background += v != background;
+		if (encoded)
+		{
+			stored = sparse.runs.size() * rowcodec::run_merge_gap + sparse.values.size();
+			std::vector<float> dense(cols, -1.f);
+			rowcodec::expand(sparse, dense.data(), cols);
+			if (dense != row || stored > budget)
+			{
+				std::printf("Sparse row of %d columns doesn't round trip\n", cols);
+				return false;
+			}
+		}
+		else if (size_t(non_background) <= budget / (1 + rowcodec::run_merge_gap))
+		{
+			// every value in a run of its own would have fit
+			std::printf("Sparse row of %d columns with %d values refused for budget %zu\n", cols, non_background,
+					budget);
+			return false;
+		}
+	}
+	return true;
+}
+
+void scalar_transpose(const float* columns, int n, int rows, float* block)
+{
+	for (int col = 0; col < n; ++col)
+	{
+		for (int r = 0; r < rows; ++r)
+			block[size_t(r) * n + col] = columns[size_t(col) * rows + r];
+	}
+}
+
+bool check_transpose(std::mt19937& g)
+{
+	for (int rows = 1; rows <= 70; ++rows)
+	{
+		for (int n = 1; n <= 70; ++n)
+		{
+			std::vector<float> columns(size_t(rows) * n);
+			for (float& v : columns)
+				v = float(g() % 100000);
+			std::vector<float> blocked(columns.size(), -1.f);
+			std::vector<float> expected(columns.size());
+			rowcodec::transpose(columns.data(), n, rows, blocked.data());
+			scalar_transpose(columns.data(), n, rows, expected.data());
+			if (blocked != expected)
+			{
+				std::printf("Transpose of %d columns of %d rows differs\n", n, rows);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/// Appends batches of columns to the band [row_begin, row_begin + rows) of a matrix, as append_columns() does
+bool check_append(std::mt19937& g)
+{
+	const int matrix_rows = 100;
+	const int width = 90;
+	for (int row_begin : {0, 3, 17, 45})
+	{
+		for (int rows : {1, 5, 33, 55})
+		{
+			std::vector<float> matrix(size_t(matrix_rows) * width, 0.f);
+			std::vector<float> expected = matrix;
+			int cursor = int(g() % width);
+			for (int batch = 0; batch < 20; ++batch)
+			{
+				const int n = 1 + g() % width;
+				std::vector<float> columns(size_t(rows) * n);
+				for (float& v : columns)
+					v = float(g() % 100000);
+				for (int col = 0; col < n; ++col)
+				{
+					for (int r = 0; r < rows; ++r)
+						expected[size_t(row_begin + r) * width + (cursor + col) % width] = columns[size_t(col) * rows + r];
+				}
+
+				// one block per side of the wrap-around
+				const float* in = columns.data();
+				for (int left = n; left > 0;)
+				{
+					const int block_cols = std::min(left, width - cursor);
+					std::vector<float> block(size_t(block_cols) * rows);
+					rowcodec::transpose(in, block_cols, rows, block.data());
+					rowcodec::write_block(block.data(), rows, block_cols, matrix.data(), width, row_begin, cursor);
+					in += size_t(block_cols) * rows;
+					left -= block_cols;
+					cursor = (cursor + block_cols) % width;
+				}
+			}
+			if (matrix != expected)
+			{
+				std::printf("Columns appended to %d rows from row %d differ\n", rows, row_begin);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void time_transpose(int rows, int n, int rounds)
+{
+	std::vector<float> columns(size_t(rows) * n);
+	for (size_t i = 0; i < columns.size(); ++i)
+		columns[i] = float(i);
+	std::vector<float> block(columns.size());
+
+	auto t0 = clock::now();
+	for (int r = 0; r < rounds; ++r)
+	{
+		rowcodec::transpose(columns.data(), n, rows, block.data());
+	}
+	const double blocked = seconds_since(t0) / rounds;
+	t0 = clock::now();
+	for (int r = 0; r < rounds; ++r)
+	{
+		scalar_transpose(columns.data(), n, rows, block.data());
+	}
+	const double scalar = seconds_since(t0) / rounds;
+	const double values = double(rows) * n;
+	std::printf("%d rows x %d columns: %.2f ns per value blocked, %.2f ns scalar\n", rows, n, blocked / values * 1e9,
+			scalar / values * 1e9);
+}
+
+void time_sparse(int cols, int rounds)
+{
+	std::vector<float> row(cols, 0.f);
+	const int half_width = 40;
+	for (int i = 0; i < 2 * half_width; ++i)
+	{
+		row[cols / 3 + i] = std::exp(-(i - half_width) * (i - half_width) / 100.0f);
+	}
+
+	rowcodec::SparseRow sparse;
+	auto t0 = clock::now();
+	for (int r = 0; r < rounds; ++r)
+	{
+		rowcodec::sparsify(row, 0.f, size_t(0.25 * cols), sparse);
+	}
+	const double encode = seconds_since(t0) / rounds;
+
+	std::vector<float> dense(cols);
+	t0 = clock::now();
+	for (int r = 0; r < rounds; ++r)
+	{
+		rowcodec::expand(sparse, dense.data(), cols);
+	}
+	const double expand = seconds_since(t0) / rounds;
+
+	IntensitySketch dense_stats;
+	t0 = clock::now();
+	for (int r = 0; r < rounds; ++r)
+	{
+		dense_stats.add(row.data(), row.size());
+	}
+	const double stats_dense = seconds_since(t0) / rounds;
+
+	IntensitySketch sparse_stats;
+	t0 = clock::now();
+	for (int r = 0; r < rounds; ++r)
+	{
+		sparse_stats.add(sparse.values.data(), sparse.values.size());
+		sparse_stats.add_constant(sparse.background, cols - sparse.values.size());
+	}
+	const double stats_sparse = seconds_since(t0) / rounds;
+
+	std::printf("%d columns, %zu run(s) of %zu values instead of %zu bytes:\n", cols, sparse.runs.size(),
+			sparse.values.size(), cols * sizeof(float));
+	std::printf("  encode %.2f us, expand %.2f us\n", encode * 1e6, expand * 1e6);
+	std::printf("  statistics %.2f us dense, %.2f us sparse\n", stats_dense * 1e6, stats_sparse * 1e6);
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+	const int cols = argc > 1 ? std::max(100, std::atoi(argv[1])) : 2000;
+	const int rounds = argc > 2 ? std::max(1, std::atoi(argv[2])) : 20000;
+
+	std::mt19937 g(5);
+	const bool sparse_ok = check_sparse(g);
+	std::printf("Sparse round trips: %s\n", sparse_ok ? "ok" : "FAILED");
+	time_sparse(cols, rounds);
+
+	const bool transpose_ok = check_transpose(g);
+	const bool append_ok = check_append(g);
+	std::printf("Transpose: %s, appended columns: %s\n", transpose_ok ? "ok" : "FAILED", append_ok ? "ok" : "FAILED");
+	time_transpose(360, 64, 2000);
+	time_transpose(2000, 64, 500);
+	time_transpose(4096, 256, 50);
+	return sparse_ok && transpose_ok && append_ok ? 0 : 1;
+}
@@ -0,0 +1,235 @@
+#include "rowrecorder.h"
+#include "matrixfile.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+namespace
+{
+unsigned char* alloc_block(size_t size)
+{
+	void* p = nullptr;
+	// O_DIRECT needs buffers aligned to the logical block size; a page covers all common devices
+	if (posix_memalign(&p, matrixfile::header_block, size) != 0)
+	{
+		return nullptr;
+	}
+	return static_cast<unsigned char*>(p);
+}
+} // namespace
+
+RowRecorder::RowRecorder(const std::string& path, size_t rows, size_t cols, int components, bool direct_io)
+	: path(path)
+	, rows(rows)
+	, cols(cols)
+	, components(components)
+	, fd(-1)
+	, direct_io(direct_io)
+	, failed(false)
+	, block(alloc_block(block_size), &free)
+	, block_fill(0)
+	, file_offset(0)
+	, block_records(0)
+	, flushed_records(0)
+	, n_ports(0)
+	, stop(false)
+	, n_written(0)
+	, n_dropped(0)
+{
+	static_assert(block_size % matrixfile::header_block == 0, "blocks must stay aligned");
+
+	if (!block)
+	{
+		std::cerr << "Recorder: cannot allocate write buffer\n";
+		return;
+	}
+
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+	if (direct_io)
+	{
+		fd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+		if (fd < 0)
+		{
+			std::cerr << "Recorder: O_DIRECT not supported for " << path << ", using buffered writes\n";
+			this->direct_io = false;
+		}
+	}
+#else
+	this->direct_io = false;
+#endif
+	if (fd < 0)
+	{
+		fd = ::open(path.c_str(), flags, 0644);
+	}
+	if (fd < 0)
+	{
+		std::cerr << "Recorder: cannot open " << path << "\n";
+		return;
+	}
+
+	// the header occupies the first block, rows follow aligned
+	matrixfile::Header h = matrixfile::make_header(rows, cols, components);
+	memset(block.get(), 0, matrixfile::header_block);
+	memcpy(block.get(), &h, sizeof(h));
+	block_fill = matrixfile::header_block;
+
+	writer = std::thread([this] { run(); });
+}
+
+RowRecorder::~RowRecorder()
+{
+	if (writer.joinable())
+	{
+		stop.store(true);
+		writer.join();
+	}
+	if (fd >= 0)
+	{
+		::close(fd);
+	}
+}
+
+RowRecorder::Port* RowRecorder::add_port()
+{
+	std::lock_guard<std::mutex> lock(ports_mutex);
+	const size_t n = n_ports.load();
+	if (n == max_ports)
+	{
+		std::cerr << "Recorder: too many producers, not recording the new one\n";
+		return nullptr;
+	}
+	ports[n] = std::make_unique<Port>();
+	n_ports.store(n + 1, std::memory_order_release);
+	return ports[n].get();
+}
+
+void RowRecorder::run()
+{
+	while (!stop.load())
+	{
+		size_t n = 0;
+		const size_t active = n_ports.load(std::memory_order_acquire);
+		for (size_t i = 0; i < active; ++i)
+		{
+			n += drain(*ports[i], queue_capacity);
+		}
+		if (n == 0)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+
+	// producers may still be running; take what was queued when we were stopped
+	const size_t active = n_ports.load(std::memory_order_acquire);
+	for (size_t i = 0; i < active; ++i)
+	{
+		drain(*ports[i], ports[i]->queue.size_approx());
+	}
+
+	finish();
+}
+
+size_t RowRecorder::drain(Port& port, size_t max)
+{
+	Write w;
+	size_t n = 0;
+	while (n < max && port.queue.try_dequeue(w))
+	{
+		store(w);
+		++n;
+	}
+	return n;
+}
+
+void RowRecorder::store(const Write& w)
+{
+	if (failed)
+	{
+		n_dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	const matrixfile::Record record{uint32_t(w.row), uint32_t(w.col_begin), uint32_t(w.values->size()), 0};
+	copy(&record, sizeof(record), false);
+	copy(w.values->data(), w.values->size() * sizeof(float), true);
+	if (!failed)
+	{
+		n_written.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void RowRecorder::copy(const void* data, size_t bytes, bool ends_record)
+{
+	// records may straddle block boundaries; the file is a plain byte stream
+	const unsigned char* src = static_cast<const unsigned char*>(data);
+	while (bytes > 0 && !failed)
+	{
+		size_t n = std::min(bytes, block_size - block_fill);
+		memcpy(block.get() + block_fill, src, n);
+		block_fill += n;
+		src += n;
+		bytes -= n;
+
+		if (bytes == 0 && ends_record)
+			++block_records;
+		if (block_fill == block_size)
+			write_block(block_size);
+	}
+}
+
+bool RowRecorder::write_block(size_t bytes)
+{
+	size_t done = 0;
+	while (done < bytes)
+	{
+		ssize_t n = pwrite(fd, block.get() + done, bytes - done, file_offset + done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+		{
+			std::cerr << "Recorder: write to " << path << " failed, dropping further rows\n";
+			failed = true;
+			return false;
+		}
+		done += n;
+	}
+	file_offset += bytes;
+	block_fill = 0;
+	flushed_records += block_records;
+	block_records = 0;
+	return true;
+}
+
+void RowRecorder::finish()
+{
+	if (!failed && block_fill > 0)
+	{
+		// the tail isn't a full block; O_DIRECT can't write it
+		if (direct_io)
+		{
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+		}
+		write_block(block_fill);
+	}
+
+	// leave the records of a block which couldn't be written out of the count
+	matrixfile::Header h = matrixfile::make_header(rows, cols, components);
+	h.row_count = flushed_records;
+	if (direct_io)
+	{
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+	}
+	if (pwrite(fd, &h, sizeof(h), 0) != ssize_t(sizeof(h)))
+	{
+		std::cerr << "Recorder: cannot update header of " << path << "\n";
+	}
+
+	std::cerr << "Recorder: " << h.row_count << " writes recorded to " << path << ", " << dropped() << " dropped\n";
+}
@@ -0,0 +1,111 @@
+#ifndef ROWRECORDER_H
+#define ROWRECORDER_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <lockfree_q/readerwriterqueue.h>
+
+/* Archives a row stream in the format read by ReplaySource.
+ *
+ * Every write is recorded with the matrix row and first column it went to,
+ * so random row order, column bands and the rows of several producers replay
+ * as displayed.
+ *
+ * push() hands the shared row to a dedicated writer thread through a bounded
+ * lock-free queue and never blocks or allocates; if the disk falls behind and
+ * the queue is full, the row is dropped and counted. Every producer thread
+ * pushes through a port of its own, as the queues are single-producer. The
+ * writer collects rows into large page-aligned blocks, which allows writing
+ * with O_DIRECT. Rows of different ports are interleaved in the order the
+ * writer picks them up.
+ */
+class RowRecorder
+{
+public:
+	using RowPtr = std::shared_ptr<std::vector<float>>;
+
+	static constexpr size_t block_size = 1 << 20;
+	static constexpr size_t queue_capacity = 8192;
+	static constexpr size_t max_ports = 64;
+
+	/// The columns [col_begin, col_begin + values->size()) of a row
+	struct Write
+	{
+		int row;
+		int col_begin;
+		RowPtr values;
+	};
+
+	struct Port
+	{
+		Port()
+			: queue(queue_capacity)
+		{
+		}
+		moodycamel::ReaderWriterQueue<Write> queue;
+	};
+
+	/// cols counts values, components of them per column
+	RowRecorder(const std::string& path, size_t rows, size_t cols, int components, bool direct_io);
+	~RowRecorder();
+
+	bool is_open() const { return fd >= 0; }
+
+	/// Port for one producer thread; thread-safe, nullptr when all are taken
+	Port* add_port();
+
+	/// Called from the port's producer thread; drops the write if the writer is behind
+	void push(Port* port, int row, int col_begin, const RowPtr& values)
+	{
+		if (!port->queue.try_enqueue(Write{row, col_begin, values}))
+		{
+			n_dropped.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	uint64_t written() const { return n_written.load(std::memory_order_relaxed); }
+	uint64_t dropped() const { return n_dropped.load(std::memory_order_relaxed); }
+
+private:
+	RowRecorder(const RowRecorder&) = delete;
+	RowRecorder& operator=(const RowRecorder&) = delete;
+
+	void run();
+	size_t drain(Port& port, size_t max);
+	void store(const Write& w);
+	/// Appends to the block, writing it out when full; ends_record counts a record ending with these bytes
+	void copy(const void* data, size_t bytes, bool ends_record);
+	bool write_block(size_t bytes);
+	void finish();
+
+	std::string path;
+	size_t rows;
+	size_t cols;
+	int components;
+	int fd;
+	bool direct_io;
+	bool failed;
+
+	std::unique_ptr<unsigned char, void (*)(void*)> block;
+	size_t block_fill;
+	uint64_t file_offset;
+	uint64_t block_records;   ///< records ending in the block being filled
+	uint64_t flushed_records; ///< records written out completely
+
+	std::array<std::unique_ptr<Port>, max_ports> ports;
+	std::atomic<size_t> n_ports;
+	std::mutex ports_mutex; ///< serializes add_port()
+	std::atomic<bool> stop;
+	std::atomic<uint64_t> n_written;
+	std::atomic<uint64_t> n_dropped;
+	std::thread writer;
+};
+
+#endif
@@ -0,0 +1,220 @@
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+
+/* Single-producer, single-consumer ring of fixed size rows in POSIX shared
+ * memory, for feeding the widget from another process.
+ *
+ * The design follows moodycamel::ReaderWriterQueue: the producer owns head,
+ * the consumer owns tail, and each side keeps a private copy of the other
+ * side's index, so the shared cache lines are only touched when the cached
+ * value says the ring is full (producer) or empty (consumer). Rows are
+ * written in place, without syscalls or intermediate copies.
+ *
+ * The ingest server create()s the ring sized to its widget; producer
+ * processes attach() to it by name and use begin_write()/commit_write() or
+ * try_push(). This header has no Qt dependency so producers can include it.
+ */
+class ShmRowRing
+{
+public:
+	static std::unique_ptr<ShmRowRing> create(const std::string& name, size_t cols, size_t slot_count)
+	{
+		if (slot_count == 0 || (slot_count & (slot_count - 1)) != 0)
+		{
+			std::cerr << "ShmRowRing: slot count must be a power of two\n";
+			return nullptr;
+		}
+		shm_unlink(name.c_str()); // stale ring of a previous run
+		int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+		if (fd < 0)
+		{
+			std::cerr << "ShmRowRing: cannot create " << name << "\n";
+			return nullptr;
+		}
+		const size_t size = data_offset + slot_count * cols * sizeof(float);
+		if (ftruncate(fd, size) != 0)
+		{
+			std::cerr << "ShmRowRing: cannot size " << name << "\n";
+			::close(fd);
+			shm_unlink(name.c_str());
+			return nullptr;
+		}
+
+		std::unique_ptr<ShmRowRing> ring(map(fd, size));
+		if (!ring)
+		{
+			shm_unlink(name.c_str());
+			return nullptr;
+		}
+		ring->name = name;
+		ring->owner = true;
+
+		Header* h = ring->header;
+		h->version = version;
+		h->cols = cols;
+		h->slot_count = slot_count;
+		h->head.store(0, std::memory_order_relaxed);
+		h->tail.store(0, std::memory_order_relaxed);
+		memcpy(h->magic, magic(), sizeof(h->magic));
+		h->ready.store(1, std::memory_order_release);
+		ring->init_local();
+		return ring;
+	}
+
+	static std::unique_ptr<ShmRowRing> attach(const std::string& name)
+	{
+		int fd = shm_open(name.c_str(), O_RDWR, 0);
+		if (fd < 0)
+		{
+			std::cerr << "ShmRowRing: cannot open " << name << "\n";
+			return nullptr;
+		}
+		struct stat st;
+		if (fstat(fd, &st) != 0 || size_t(st.st_size) < data_offset)
+		{
+			::close(fd);
+			return nullptr;
+		}
+
+		std::unique_ptr<ShmRowRing> ring(map(fd, st.st_size));
+		if (!ring)
+			return nullptr;
+
+		Header* h = ring->header;
+		if (h->ready.load(std::memory_order_acquire) != 1 || memcmp(h->magic, magic(), sizeof(h->magic)) != 0 ||
+				h->version != version || h->slot_count == 0 || (h->slot_count & (h->slot_count - 1)) != 0 ||
+				data_offset + h->slot_count * h->cols * sizeof(float) > ring->size)
+		{
+			std::cerr << "ShmRowRing: " << name << " is not a row ring\n";
+			return nullptr;
+		}
+		ring->init_local();
+		return ring;
+	}
+
+	~ShmRowRing()
+	{
+		munmap(header, size);
+		if (owner)
+		{
+			shm_unlink(name.c_str());
+		}
+	}
+
+	size_t cols() const { return n_cols; }
+
+	/// Producer: slot to fill with cols() floats, or nullptr if the ring is full
+	float* begin_write()
+	{
+		const uint64_t head = header->head.load(std::memory_order_relaxed);
+		if (head - cached_tail >= n_slots)
+		{
+			cached_tail = header->tail.load(std::memory_order_acquire);
+			if (head - cached_tail >= n_slots)
+				return nullptr;
+		}
+		return slot(head);
+	}
+
+	/// Producer: publish the slot returned by begin_write()
+	void commit_write() { header->head.store(header->head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+	bool try_push(const float* row)
+	{
+		float* dst = begin_write();
+		if (!dst)
+			return false;
+		memcpy(dst, row, n_cols * sizeof(float));
+		commit_write();
+		return true;
+	}
+
+	/// Consumer: oldest unread row, or nullptr if the ring is empty
+	const float* begin_read()
+	{
+		const uint64_t tail = header->tail.load(std::memory_order_relaxed);
+		if (tail == cached_head)
+		{
+			cached_head = header->head.load(std::memory_order_acquire);
+			if (tail == cached_head)
+				return nullptr;
+		}
+		return slot(tail);
+	}
+
+	/// Consumer: release the row returned by begin_read()
+	void end_read() { header->tail.store(header->tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+private:
+	static const char* magic() { return "QSMRING"; } // 8 bytes with the terminator
+	static constexpr uint32_t version = 1;
+	static constexpr size_t cache_line = 64;
+
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		std::atomic<uint32_t> ready;
+		uint64_t cols;
+		uint64_t slot_count;
+		alignas(cache_line) std::atomic<uint64_t> head; ///< next slot to write, owned by the producer
+		alignas(cache_line) std::atomic<uint64_t> tail; ///< next slot to read, owned by the consumer
+	};
+	static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "the ring needs address-free 64 bit atomics");
+
+	static constexpr size_t data_offset = (sizeof(Header) + cache_line - 1) / cache_line * cache_line;
+
+	ShmRowRing() = default;
+
+	static ShmRowRing* map(int fd, size_t size)
+	{
+		void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (addr == MAP_FAILED)
+		{
+			std::cerr << "ShmRowRing: mmap failed\n";
+			return nullptr;
+		}
+		ShmRowRing* ring = new ShmRowRing;
+		ring->header = static_cast<Header*>(addr);
+		ring->size = size;
+		return ring;
+	}
+
+	void init_local()
+	{
+		n_cols = header->cols;
+		n_slots = header->slot_count;
+		cached_tail = header->tail.load(std::memory_order_acquire);
+		cached_head = header->head.load(std::memory_order_acquire);
+	}
+
+	float* slot(uint64_t idx) const
+	{
+		return reinterpret_cast<float*>(reinterpret_cast<char*>(header) + data_offset) + (idx & (n_slots - 1)) * n_cols;
+	}
+
+	Header* header = nullptr;
+	size_t size = 0;
+	std::string name;
+	bool owner = false;
+
+	size_t n_cols = 0;
+	uint64_t n_slots = 0;
+	uint64_t cached_tail = 0; ///< producer's copy of tail
+	uint64_t cached_head = 0; ///< consumer's copy of head
+};
+
+#endif
@@ -0,0 +1,155 @@
+#include "spectrogram.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+static int fft_size(int cols)
+{
+	int n = 8;
+	while (n / 2 < cols)
+		n *= 2;
+	return n;
+}
+
+Spectrogram::Channel::Channel(MatrixUploader::Producer sink)
+	: sink(sink)
+	, queue(queue_capacity)
+	, fft(fft_size(sink.columnCount()))
+	, window(fft.size())
+	, column_bins(sink.columnCount() + 1)
+	, skip(0)
+	, frame(fft.size())
+	, bins(fft.size() / 2)
+{
+	const int n = fft.size();
+	const double pi = std::acos(-1.0);
+	double sum = 0.0;
+	for (int i = 0; i < n; ++i)
+	{
+		window[i] = 0.5 - 0.5 * std::cos(2 * pi * i / n);
+		sum += window[i];
+	}
+	// a sine of amplitude 1 at a bin centre has |X| = sum / 2
+	scale = 4.0 / (sum * sum);
+
+	const int cols = sink.columnCount();
+	for (int c = 0; c <= cols; ++c)
+	{
+		column_bins[c] = int(size_t(c) * bins.size() / cols);
+	}
+}
+
+Spectrogram::Spectrogram(int hop, Scale scale)
+	: hop_size(std::max(1, hop))
+	, scale(scale)
+	, n_channels(0)
+	, stop(false)
+	, n_dropped(0)
+{
+}
+
+Spectrogram::~Spectrogram()
+{
+	stop.store(true);
+	for (auto& t : threads)
+	{
+		t.join();
+	}
+}
+
+int Spectrogram::add_channel(MatrixUploader::Producer sink)
+{
+	assert(threads.empty());
+	if (n_channels == int(max_channels) || !sink.isValid() || sink.columnCount() < 1)
+	{
+		std::cerr << "Can't add a spectrogram channel\n";
+		return -1;
+	}
+	channels[n_channels].reset(new Channel(sink));
+	return n_channels++;
+}
+
+void Spectrogram::start()
+{
+	for (int i = 0; i < n_channels; ++i)
+	{
+		threads.emplace_back([this, i] { run(i); });
+	}
+}
+
+void Spectrogram::push(int channel, const float* samples, size_t n)
+{
+	if (!channels[channel]->queue.try_enqueue(std::vector<float>(samples, samples + n)))
+	{
+		n_dropped.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void Spectrogram::run(int index)
+{
+	Channel& c = *channels[index];
+	using namespace std::chrono;
+	using clock = steady_clock;
+
+	const size_t n = c.fft.size();
+	std::vector<float> block;
+	auto report_start = clock::now();
+	long n_rows = 0;
+	clock::duration busy(0);
+
+	while (!stop.load(std::memory_order_relaxed))
+	{
+		if (c.queue.wait_dequeue_timed(block, milliseconds(100)))
+		{
+			const auto t = clock::now();
+			c.pending.insert(c.pending.end(), block.begin(), block.end());
+			size_t used = c.skip;
+			while (used + n <= c.pending.size())
+			{
+				emit_row(c, c.pending.data() + used);
+				used += hop_size;
+				++n_rows;
+			}
+			const size_t consumed = std::min(used, c.pending.size());
+			c.skip = used - consumed;
+			c.pending.erase(c.pending.begin(), c.pending.begin() + consumed);
+			busy += clock::now() - t;
+		}
+
+		const auto now = clock::now();
+		if (now - report_start >= seconds(1))
+		{
+			const double s = duration<double>(now - report_start).count();
+			std::cerr << "Spectrogram channel " << index << ": " << n_rows / s << " rows/s";
+			if (n_rows > 0)
+				std::cerr << ", " << duration<double, std::micro>(busy).count() / n_rows << " us per row";
+			std::cerr << ", " << droppedBlocks() << " blocks dropped\n";
+			report_start = now;
+			n_rows = 0;
+			busy = clock::duration(0);
+		}
+	}
+}
+
+void Spectrogram::emit_row(Channel& c, const float* frame_begin)
+{
+	const int n = c.fft.size();
+	for (int i = 0; i < n; ++i)
+	{
+		c.frame[i] = frame_begin[i] * c.window[i];
+	}
+	c.fft.power(c.frame.data(), c.bins.data());
+
+	const int cols = c.sink.columnCount();
+	MatrixUploader::Row row(cols);
+	for (int col = 0; col < cols; ++col)
+	{
+		const float p = c.scale * *std::max_element(c.bins.begin() + c.column_bins[col], c.bins.begin() + c.column_bins[col + 1]);
+		// log2f is faster than log10f in glibc
+		row[col] = scale == Scale::Decibel ? 3.0103f * std::log2(std::max(p, 1e-30f)) : p;
+	}
+	c.sink.append(std::move(row));
+}
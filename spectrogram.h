@@ -0,0 +1,90 @@
+#ifndef SPECTROGRAM_H
+#define SPECTROGRAM_H
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <lockfree_q/readerwriterqueue.h>
+
+#include "matrixuploader.h"
+#include "realfft.h"
+
+/* Producer side stage turning time domain samples into spectrogram rows.
+ *
+ * Every channel feeds one producer of a widget: push() hands blocks of
+ * samples to the channel's worker thread through a bounded lock-free queue,
+ * dropping (and counting) them if the worker falls behind, so the caller
+ * never blocks. The worker cuts frames of fftSize() samples every `hop`
+ * samples, applies a Hann window and appends the power spectrum as a row.
+ * The FFT size is the smallest power of two with at least as many bins as
+ * the producer has columns; where there are more bins, a column shows the
+ * largest of its bins, which keeps narrow lines visible. Channels are
+ * independent, so they transform in parallel.
+ *
+ * The achieved rows/s and the CPU time per row, i.e. the rows/s one core
+ * sustains, are reported per channel every second.
+ */
+class Spectrogram
+{
+public:
+	enum class Scale
+	{
+		Power,   ///< |X|^2, relative to a full scale sine at a bin centre
+		Decibel, ///< of that power
+	};
+
+	static constexpr size_t queue_capacity = 1024;
+	static constexpr size_t max_channels = 64;
+
+	Spectrogram(int hop, Scale scale);
+	~Spectrogram();
+
+	/// Before start(); returns the channel, -1 if all are taken
+	int add_channel(MatrixUploader::Producer sink);
+	void start();
+
+	/// From one thread per channel; copies the samples
+	void push(int channel, const float* samples, size_t n);
+
+	int hop() const { return hop_size; }
+	/// Of a channel's frames
+	int fftSize(int channel) const { return channels[channel]->fft.size(); }
+	long droppedBlocks() const { return n_dropped.load(std::memory_order_relaxed); }
+
+private:
+	Spectrogram(const Spectrogram&) = delete;
+	Spectrogram& operator=(const Spectrogram&) = delete;
+
+	struct Channel
+	{
+		Channel(MatrixUploader::Producer sink);
+
+		MatrixUploader::Producer sink;
+		moodycamel::BlockingReaderWriterQueue<std::vector<float>> queue;
+		RealFft fft;
+		std::vector<float> window;
+		std::vector<int> column_bins; ///< first bin of each column, and the end of the last
+		std::vector<float> pending;   ///< samples not yet in a frame, oldest first
+		size_t skip;                  ///< samples still to drop when the hop is longer than a frame
+		std::vector<float> frame;
+		std::vector<float> bins;
+		float scale; ///< of the power, for the window's gain
+	};
+
+	void run(int index);
+	/// Appends the row of the fftSize() samples from frame_begin
+	void emit_row(Channel& c, const float* frame_begin);
+
+	int hop_size;
+	Scale scale;
+	std::array<std::unique_ptr<Channel>, max_channels> channels;
+	int n_channels;
+	std::atomic<bool> stop;
+	std::atomic<long> n_dropped;
+	std::vector<std::thread> threads;
+};
+
+#endif
@@ -0,0 +1,245 @@
+#include "stagingring.h"
+
+#include <QElapsedTimer>
+#include <QOpenGLContext>
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+// from GL 4.4 / EXT_buffer_storage, which the GL 3.3 and ES 3.0 headers may lack
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+#ifndef GL_DYNAMIC_STORAGE_BIT
+#define GL_DYNAMIC_STORAGE_BIT 0x0100
+#endif
+
+StagingRing::StagingRing()
+	: mode(Mode::MapUnsynchronized)
+	, buffer(0)
+	, cap(0)
+	, head(0)
+	, segment_begin(0)
+	, mapped_offset(0)
+	, mapped_size(0)
+	, buffer_storage(nullptr)
+	, persistent_ptr(nullptr)
+	, wait_time(0.0)
+	, waited(0.0)
+{
+}
+
+StagingRing::~StagingRing() { assert(!isInitialized() && "destroy() must be called with a context current"); }
+
+bool StagingRing::initialize(size_t capacity, Mode mode)
+{
+	initializeOpenGLFunctions();
+	this->mode = mode;
+	buffer_storage = nullptr;
+	QOpenGLContext* context = QOpenGLContext::currentContext();
+	const bool core = !context->isOpenGLES() && context->format().version() >= qMakePair(4, 4);
+	if (core || context->hasExtension(QByteArrayLiteral("GL_ARB_buffer_storage")))
+		buffer_storage = reinterpret_cast<BufferStorage>(context->getProcAddress("glBufferStorage"));
+	else if (context->hasExtension(QByteArrayLiteral("GL_EXT_buffer_storage")))
+		buffer_storage = reinterpret_cast<BufferStorage>(context->getProcAddress("glBufferStorageEXT"));
+	if (mode == Mode::Persistent && !buffer_storage)
+	{
+		return false;
+	}
+
+	glGenBuffers(1, &buffer);
+	cap = 0;
+	grow(capacity);
+	return cap > 0;
+}
+
+void StagingRing::destroy()
+{
+	if (!isInitialized())
+		return;
+	clear_pending();
+	if (persistent_ptr)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		persistent_ptr = nullptr;
+	}
+	glDeleteBuffers(1, &buffer);
+	buffer = 0;
+	cap = 0;
+	std::vector<char>().swap(scratch);
+}
+
+void StagingRing::clear_pending()
+{
+	for (const Segment& s : pending)
+	{
+		glDeleteSync(s.fence);
+	}
+	pending.clear();
+}
+
+void StagingRing::grow(size_t capacity)
+{
+	capacity = (capacity + alignment - 1) / alignment * alignment;
+	if (capacity <= cap)
+		return;
+
+	// the old storage is orphaned (or deleted once unused), so its fences don't matter for the new one
+	clear_pending();
+	if (immutable() && cap > 0)
+	{
+		// immutable storage can't be re-specified
+		if (persistent_ptr)
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			persistent_ptr = nullptr;
+		}
+		glDeleteBuffers(1, &buffer);
+		glGenBuffers(1, &buffer);
+	}
+	cap = capacity;
+	head = 0;
+	segment_begin = 0;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+	if (!allocate())
+	{
+		std::cerr << "Allocating the staging ring didn't work\n";
+		cap = 0;
+	}
+}
+
+bool StagingRing::allocate()
+{
+	GLbitfield flags = GL_MAP_WRITE_BIT;
+	switch (mode)
+	{
+	case Mode::Persistent:
+		flags |= GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		buffer_storage(GL_PIXEL_UNPACK_BUFFER, cap, nullptr, flags);
+		persistent_ptr = static_cast<char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, cap, flags));
+		return persistent_ptr != nullptr;
+	case Mode::BufferSubData:
+		scratch.resize(cap);
+		flags = GL_DYNAMIC_STORAGE_BIT;
+		break;
+	case Mode::MapUnsynchronized:
+	case Mode::Orphan:
+		break;
+	}
+	if (immutable())
+		buffer_storage(GL_PIXEL_UNPACK_BUFFER, cap, nullptr, flags);
+	else
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, cap, nullptr, GL_STREAM_DRAW);
+	return true;
+}
+
+void StagingRing::wait_for(size_t begin, size_t end)
+{
+	QElapsedTimer timer;
+	timer.start();
+	// the oldest segments are the ones wrapped onto, all others lie after them in the ring
+	while (!pending.empty() && pending.front().begin < end && pending.front().end > begin)
+	{
+		GLenum state = glClientWaitSync(pending.front().fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		while (state == GL_TIMEOUT_EXPIRED)
+		{
+			state = glClientWaitSync(pending.front().fence, 0, 1000000);
+		}
+		if (state == GL_WAIT_FAILED)
+		{
+			std::cerr << "Waiting for a staging transfer failed\n";
+		}
+		glDeleteSync(pending.front().fence);
+		pending.pop_front();
+	}
+	waited += timer.nsecsElapsed() * 1e-9;
+}
+
+void* StagingRing::map(size_t n, size_t& offset)
+{
+	assert(n <= cap);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+	if (head + n > cap)
+	{
+		if (mode == Mode::Orphan)
+		{
+			// fresh storage instead of waiting, the transfers in flight keep the old one
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, cap, nullptr, GL_STREAM_DRAW);
+		}
+		else
+		{
+			// the transfers from the end of the ring get their fence before we wait on the start
+			close_segment();
+		}
+		head = 0;
+		segment_begin = 0;
+	}
+	wait_for(head, head + n);
+
+	offset = head;
+	mapped_offset = head;
+	mapped_size = n;
+	head = std::min(cap, (head + n + alignment - 1) / alignment * alignment);
+
+	switch (mode)
+	{
+	case Mode::Persistent:
+		return persistent_ptr + offset;
+	case Mode::BufferSubData:
+		return scratch.data();
+	case Mode::MapUnsynchronized:
+	case Mode::Orphan:
+		break;
+	}
+	// nothing reads the range anymore: either waited for above, or fresh storage
+	void* ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, offset, n,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	if (!ptr)
+	{
+		std::cerr << "Mapping buffer didn't work :/\n";
+	}
+	return ptr;
+}
+
+void StagingRing::unmap()
+{
+	switch (mode)
+	{
+	case Mode::Persistent:
+		break; // coherent, visible to the commands issued after the write
+	case Mode::BufferSubData:
+		glBufferSubData(GL_PIXEL_UNPACK_BUFFER, mapped_offset, mapped_size, scratch.data());
+		break;
+	case Mode::MapUnsynchronized:
+	case Mode::Orphan:
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		break;
+	}
+}
+
+void StagingRing::close_segment()
+{
+	if (head != segment_begin)
+	{
+		pending.push_back(Segment{segment_begin, head, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0)});
+		segment_begin = head;
+	}
+}
+
+void StagingRing::fence()
+{
+	// orphaned storage needs no fences
+	if (mode != Mode::Orphan)
+	{
+		close_segment();
+	}
+	wait_time = wait_time > 0 ? 0.9 * wait_time + 0.1 * waited : waited;
+	waited = 0.0;
+}
@@ -0,0 +1,108 @@
+#ifndef STAGINGRING_H
+#define STAGINGRING_H
+
+#include <QOpenGLExtraFunctions>
+
+#include <deque>
+#include <vector>
+
+/* Pixel unpack buffer used as a ring for texture transfers.
+ *
+ * Ranges are handed out one after the other and wrap around at the end. The
+ * transfers issued from the ranges mapped since the last fence() are covered
+ * by one fence; before a range is handed out again, the fences of the
+ * transfers still reading it are waited for. Sized for a few frames of
+ * updates, the ring is normally far enough ahead of the GPU that they have
+ * signalled.
+ *
+ * How a range is written depends on the mode, since which is fastest
+ * depends on the driver:
+ * - MapUnsynchronized maps each range unsynchronized and invalidated.
+ * - BufferSubData writes into a CPU scratch buffer and hands it to
+ *   glBufferSubData() on unmap().
+ * - Orphan doesn't wait at the end of the ring but re-specifies the storage,
+ *   leaving the old one to the transfers still reading it.
+ * - Persistent maps immutable storage once (GL 4.4 or [ARB|EXT]_buffer_storage).
+ *
+ * Where buffer storage is available, all modes but Orphan use immutable
+ * storage, which the driver needn't check for re-specification on every
+ * transfer; growing the ring then takes a new buffer.
+ */
+class StagingRing : protected QOpenGLExtraFunctions
+{
+public:
+	enum class Mode
+	{
+		MapUnsynchronized,
+		BufferSubData,
+		Orphan,
+		Persistent,
+	};
+
+	StagingRing();
+	~StagingRing();
+
+	/// With the context current; false if the mode isn't supported by it
+	bool initialize(size_t capacity, Mode mode);
+	void destroy();
+	bool isInitialized() const { return buffer != 0; }
+
+	size_t capacity() const { return cap; }
+	/// Reallocates with at least this capacity; transfers in flight keep reading the old storage
+	void grow(size_t capacity);
+
+	/* Binds the ring to GL_PIXEL_UNPACK_BUFFER and returns where to write the
+	 * next n bytes (n <= capacity()); offset is where they will be in the
+	 * buffer. nullptr if mapping failed.
+	 */
+	void* map(size_t n, size_t& offset);
+	/// The written range becomes readable by transfers
+	void unmap();
+	/// After issuing the transfers from the ranges mapped so far
+	void fence();
+
+	/// Smoothed time spent waiting for the GPU per fence() in s
+	double waitTime() const { return wait_time; }
+
+private:
+	StagingRing(const StagingRing&) = delete;
+	StagingRing& operator=(const StagingRing&) = delete;
+
+	/// Range offsets are aligned for fast copies
+	static constexpr size_t alignment = 64;
+
+	struct Segment
+	{
+		size_t begin;
+		size_t end;
+		GLsync fence;
+	};
+
+	/// Creates storage of cap bytes for the bound buffer
+	bool allocate();
+	bool immutable() const { return buffer_storage && mode != Mode::Orphan; }
+	/// Waits for the transfers reading [begin, end)
+	void wait_for(size_t begin, size_t end);
+	void close_segment();
+	void clear_pending();
+
+	using BufferStorage = void(QOPENGLF_APIENTRYP)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+	Mode mode;
+	GLuint buffer;
+	size_t cap;
+	size_t head;          ///< next free byte
+	size_t segment_begin; ///< start of the ranges mapped since the last fence
+	std::deque<Segment> pending; ///< fenced segments, oldest first
+
+	size_t mapped_offset; ///< range of the last map()
+	size_t mapped_size;
+	BufferStorage buffer_storage; ///< nullptr without buffer storage
+	char* persistent_ptr;
+	std::vector<char> scratch; ///< BufferSubData only
+
+	double wait_time;
+	double waited; ///< since the last fence()
+};
+
+#endif
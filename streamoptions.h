@@ -0,0 +1,43 @@
+#ifndef STREAMOPTIONS_H
+#define STREAMOPTIONS_H
+
+#include <string>
+
+/// Command line selection of the data fed into the widgets
+struct StreamOptions
+{
+	int rows = 360;
+	int cols = 2000;
+	int widgets = 1;
+	int layers = 1;  ///< matrices per widget, drawn as a grid from one texture array
+
+	double gen_rate = 1200;   ///< load generator rows/s per widget, 0 = unpaced
+	int gen_burst = 1;        ///< rows appended back to back per deadline
+	int gen_duty_on_ms = 0;   ///< on/off duty cycle, both 0 = always on
+	int gen_duty_off_ms = 0;
+	int producers = 1;        ///< producer threads, spread over the widgets, at least one each
+	bool gen_random_rows = false; ///< insert at random rows of a producer's band instead of appending
+	bool gen_columns = false;     ///< append columns across a producer's rows instead of rows
+	int gen_band_cols = 0;        ///< only update this many columns around the peak, 0 = whole rows
+	int spectrogram_hop = 0;      ///< generate samples and show their spectrogram, rows this many samples apart; 0 = off
+
+	std::string replay_file; ///< replay this recording instead of the mock source
+	double replay_rate = 0;  ///< rows/s, 0 = as fast as possible
+	std::string record_file; ///< archive the displayed rows to this file
+	bool record_direct_io = false;
+	std::string ingest_shm;    ///< accept rows from other processes through this shared memory ring
+	size_t ingest_slots = 16384;
+	std::string ingest_socket; ///< accept rows from other processes on this unix socket
+	int ingest_policy = 0;     ///< handling of full queues, see MatrixUploader::IngestPolicy
+	int upload_strategy = 0;   ///< see MatrixUploader::UploadStrategy, 0 = calibrate
+	double sparse_fill = 0.25; ///< queue rows this sparse as runs, see MatrixUploader::set_sparse_fill()
+
+	int transfer = 0;            ///< display transfer function, see GLWidget::Transfer
+	double transfer_param = 1.0; ///< dB reference or gamma exponent
+	double db_floor = -60.0;     ///< dB shown without auto contrast, see GLWidget::set_db_range()
+	double db_ceiling = 0.0;
+	int interpolation = 0;       ///< see GLWidget::Interpolation
+	int complex_view = 0;        ///< 0 real samples, else I/Q pairs shown as GLWidget::ComplexView + 1
+};
+
+#endif
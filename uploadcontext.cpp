@@ -0,0 +1,148 @@
+#include "uploadcontext.h"
+#include "matrixuploader.h"
+
+#include <QCoreApplication>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+
+#include <algorithm>
+#include <iostream>
+
+UploadContext* UploadContext::the_instance = nullptr;
+
+UploadContext::UploadContext()
+	: surface(std::make_unique<QOffscreenSurface>())
+	, context(std::make_unique<QOpenGLContext>())
+	, pending(false)
+	, stopping(false)
+{
+}
+
+UploadContext::~UploadContext() = default;
+
+void UploadContext::enable()
+{
+	if (the_instance)
+		return;
+
+	// needs Qt::AA_ShareOpenGLContexts, so all widget contexts share with ours
+	QOpenGLContext* share = QOpenGLContext::globalShareContext();
+	if (!share)
+	{
+		std::cerr << "No global share context, uploading in the widgets\n";
+		return;
+	}
+
+	auto* uc = new UploadContext;
+	uc->context->setShareContext(share);
+	uc->context->setFormat(QSurfaceFormat::defaultFormat());
+	if (!uc->context->create())
+	{
+		std::cerr << "Cannot create the upload context, uploading in the widgets\n";
+		delete uc;
+		return;
+	}
+	// the surface has to be created on the GUI thread
+	uc->surface->setFormat(uc->context->format());
+	uc->surface->create();
+	uc->context->moveToThread(uc);
+
+	the_instance = uc;
+	// released on the GUI thread, where the surface was created
+	QObject::connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, [uc] {
+		uc->shutdown();
+		the_instance = nullptr;
+		delete uc;
+	});
+	uc->start();
+}
+
+void UploadContext::add(MatrixUploader* uploader)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!stopping && std::find(uploaders.begin(), uploaders.end(), uploader) == uploaders.end())
+	{
+		uploaders.push_back(uploader);
+	}
+}
+
+void UploadContext::remove(MatrixUploader* uploader)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	auto it = std::find(uploaders.begin(), uploaders.end(), uploader);
+	if (it == uploaders.end())
+		return; // never added, or already released on shutdown
+	uploaders.erase(it);
+
+	// the thread may be uploading it right now; it releases it afterwards
+	to_destroy.push_back(uploader);
+	cv.notify_all();
+	cv.wait(lock, [&] { return std::find(to_destroy.begin(), to_destroy.end(), uploader) == to_destroy.end(); });
+}
+
+void UploadContext::request_upload(MatrixUploader* uploader)
+{
+	uploader->upload_requested.store(true);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pending = true;
+	}
+	cv.notify_all();
+}
+
+void UploadContext::shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	cv.notify_all();
+	wait();
+}
+
+void UploadContext::run()
+{
+	context->makeCurrent(surface.get());
+
+	std::vector<MatrixUploader*> targets;
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true)
+	{
+		cv.wait(lock, [this] { return pending || stopping || !to_destroy.empty(); });
+
+		for (auto* u : to_destroy)
+		{
+			u->destroy();
+		}
+		to_destroy.clear();
+		cv.notify_all();
+
+		if (stopping)
+			break;
+
+		pending = false;
+		targets = uploaders;
+		lock.unlock();
+
+		// all widgets' uploads back to back, without switching contexts
+		for (auto* u : targets)
+		{
+			if (!u->upload_requested.exchange(false))
+				continue;
+			if (!u->isInitialized())
+				u->initialize(true);
+			u->upload();
+		}
+
+		lock.lock();
+	}
+
+	for (auto* u : uploaders)
+	{
+		u->destroy();
+	}
+	uploaders.clear();
+	context->doneCurrent();
+	// deleted on the GUI thread once this one has finished
+	context->moveToThread(QCoreApplication::instance()->thread());
+}
@@ -0,0 +1,61 @@
+#ifndef UPLOADCONTEXT_H
+#define UPLOADCONTEXT_H
+
+#include <QThread>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+QT_FORWARD_DECLARE_CLASS(QOffscreenSurface)
+QT_FORWARD_DECLARE_CLASS(QOpenGLContext)
+
+class MatrixUploader;
+
+/* One background thread with a GL context in the global share group, which
+ * runs the uploads of all widgets.
+ *
+ * Widgets request an upload when they paint and only sample the texture the
+ * previous upload finished, so the GUI thread does no transfers at all and
+ * the uploads of many widgets are batched without context switches. Textures
+ * and staging rings belong to the share group and survive the re-creation of a
+ * widget's context when it is docked or undocked.
+ */
+class UploadContext : public QThread
+{
+public:
+	/// Creates and starts the thread; call once, after the QApplication
+	static void enable();
+	/// nullptr unless enabled, and again once the application is about to quit
+	static UploadContext* instance() { return the_instance; }
+
+	void add(MatrixUploader* uploader);
+	/// Blocks until the uploader's GL resources are released
+	void remove(MatrixUploader* uploader);
+	void request_upload(MatrixUploader* uploader);
+
+	/// Releases all GL resources and stops the thread; done and the instance deleted on aboutToQuit
+	void shutdown();
+
+protected:
+	void run() override;
+
+private:
+	UploadContext();
+	~UploadContext();
+
+	std::unique_ptr<QOffscreenSurface> surface;
+	std::unique_ptr<QOpenGLContext> context;
+
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::vector<MatrixUploader*> uploaders;
+	std::vector<MatrixUploader*> to_destroy;
+	bool pending;
+	bool stopping;
+
+	static UploadContext* the_instance;
+};
+
+#endif
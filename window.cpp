@@ -50,10 +50,15 @@
 
 #include "window.h"
 #include "glwidget.h"
+#include "ingestserver.h"
+#include "loadgenerator.h"
 #include "mainwindow.h"
+#include "replaysource.h"
 #include <QApplication>
 #include <QCheckBox>
+#include <QComboBox>
 #include <QDesktopWidget>
+#include <QGridLayout>
 #include <QHBoxLayout>
 #include <QKeyEvent>
 #include <QMessageBox>
@@ -61,39 +66,116 @@
 #include <QSlider>
 #include <QVBoxLayout>
 
-#include <random>
+#include <cmath>
 
-Window::Window(MainWindow* mw)
+Window::Window(MainWindow* mw, const StreamOptions& options)
 	: mainWindow(mw)
 {
-	glWidget = new GLWidget(360, 2000);
-
-	xSlider = createSlider();
-	ySlider = createSlider();
-	zSlider = createSlider();
-
-	/*	connect(xSlider, &QSlider::valueChanged, glWidget,
-	   &GLWidget::setXRotation); connect(glWidget, &GLWidget::xRotationChanged,
-	   xSlider, &QSlider::setValue); connect(ySlider, &QSlider::valueChanged,
-	   glWidget, &GLWidget::setYRotation); connect(glWidget,
-	   &GLWidget::yRotationChanged, ySlider, &QSlider::setValue);
-		connect(zSlider, &QSlider::valueChanged, glWidget,
-	   &GLWidget::setZRotation); connect(glWidget, &GLWidget::zRotationChanged,
-	   zSlider, &QSlider::setValue);
-	*/
-	QVBoxLayout* mainLayout = new QVBoxLayout;
-	QHBoxLayout* container = new QHBoxLayout;
-	container->addWidget(glWidget);
-	container->addWidget(xSlider);
-	container->addWidget(ySlider);
-	container->addWidget(zSlider);
+	std::shared_ptr<const MappedMatrixFile> recording;
+	if (!options.replay_file.empty())
+	{
+		recording = MappedMatrixFile::open(options.replay_file);
+	}
+	// a recording is replayed as the single matrix it was recorded from
+	const int components = recording ? recording->components() : (options.complex_view == 0 ? 1 : 2);
+	const size_t rows = recording ? recording->rows() : options.rows;
+	const size_t cols = recording ? recording->cols() / components : options.cols;
+	const int layers = recording ? 1 : options.layers;
+
+	// replay, recording and ingest use the first widget, the load generator feeds all
+	const int n_widgets = std::max(1, options.widgets);
+	for (int i = 0; i < n_widgets; ++i)
+	{
+		glWidgets.push_back(new GLWidget(rows, cols, layers, components));
+		glWidgets.back()->set_ingest_policy(MatrixUploader::IngestPolicy(options.ingest_policy));
+		glWidgets.back()->set_upload_strategy(MatrixUploader::UploadStrategy(options.upload_strategy));
+		glWidgets.back()->set_sparse_fill(float(options.sparse_fill));
+	}
+	GLWidget* glWidget = glWidgets.front();
+
+	if (!options.record_file.empty())
+	{
+		auto recorder = std::make_shared<RowRecorder>(
+				options.record_file, glWidget->rowCount(), glWidget->columnCount(), components, options.record_direct_io);
+		if (recorder->is_open())
+			glWidget->set_recorder(recorder);
+	}
+
+	xSlider = createSlider(GLWidget::zoom_level_max);
+	ySlider = createSlider(GLWidget::pan_max);
+	zSlider = createSlider(GLWidget::pan_max);
 
 	QCheckBox* is_radarplot = new QCheckBox;
 	is_radarplot->setTristate(false);
 	is_radarplot->setText("Radarplot");
 
+	QCheckBox* auto_contrast = new QCheckBox;
+	auto_contrast->setText("Auto contrast");
+
+	QCheckBox* gpu_stats = new QCheckBox;
+	gpu_stats->setText("GPU statistics");
+
+	// in the order of GLWidget::Transfer
+	QComboBox* transfer = new QComboBox;
+	transfer->addItem("Linear");
+	transfer->addItem("dB");
+	transfer->addItem("Sqrt");
+	transfer->addItem("Gamma");
+
+	// in the order of GLWidget::Interpolation
+	QComboBox* interpolation = new QComboBox;
+	interpolation->addItem("Nearest");
+	interpolation->addItem("Bilinear");
+	interpolation->addItem("Bicubic");
+
+	// in the order of GLWidget::ComplexView
+	QComboBox* complex_view = new QComboBox;
+	complex_view->addItem("Magnitude");
+	complex_view->addItem("Log magnitude");
+	complex_view->addItem("Phase");
+	complex_view->setVisible(components > 1);
+
+	redraw_timer = new QTimer();
+	redraw_timer->start(17);
+
+	const int grid_cols = int(std::ceil(std::sqrt(double(n_widgets))));
+	QGridLayout* grid = new QGridLayout;
+	for (int i = 0; i < n_widgets; ++i)
+	{
+		GLWidget* widget = glWidgets[i];
+		grid->addWidget(widget, i / grid_cols, i % grid_cols);
+
+		connect(xSlider, &QSlider::valueChanged, widget, &GLWidget::set_zoom);
+		connect(widget, &GLWidget::zoom_changed, xSlider, &QSlider::setValue);
+		connect(ySlider, &QSlider::valueChanged, widget, &GLWidget::set_row_pan);
+		connect(widget, &GLWidget::row_pan_changed, ySlider, &QSlider::setValue);
+		connect(zSlider, &QSlider::valueChanged, widget, &GLWidget::set_column_pan);
+		connect(widget, &GLWidget::column_pan_changed, zSlider, &QSlider::setValue);
+		connect(is_radarplot, &QCheckBox::stateChanged, widget, &GLWidget::set_is_radarplot);
+		connect(auto_contrast, &QCheckBox::stateChanged, widget, &GLWidget::set_auto_contrast);
+		connect(gpu_stats, &QCheckBox::stateChanged, widget, &GLWidget::set_gpu_stats);
+		connect(transfer, QOverload<int>::of(&QComboBox::currentIndexChanged), widget, &GLWidget::set_transfer);
+		widget->set_transfer_param(options.transfer_param);
+		widget->set_db_range(options.db_floor, options.db_ceiling);
+		connect(interpolation, QOverload<int>::of(&QComboBox::currentIndexChanged), widget,
+				&GLWidget::set_interpolation);
+		connect(complex_view, QOverload<int>::of(&QComboBox::currentIndexChanged), widget,
+				&GLWidget::set_complex_view);
+		connect(redraw_timer, &QTimer::timeout, widget, &GLWidget::issue_redraw);
+	}
+
+	QVBoxLayout* mainLayout = new QVBoxLayout;
+	QHBoxLayout* container = new QHBoxLayout;
+	container->addLayout(grid);
+	container->addWidget(xSlider);
+	container->addWidget(ySlider);
+	container->addWidget(zSlider);
 	container->addWidget(is_radarplot);
-	connect(is_radarplot, &QCheckBox::stateChanged, glWidget, &GLWidget::set_is_radarplot);
+	container->addWidget(auto_contrast);
+	container->addWidget(gpu_stats);
+	container->addWidget(transfer);
+	container->addWidget(interpolation);
+	container->addWidget(complex_view);
 
 	QWidget* w = new QWidget;
 	w->setLayout(container);
@@ -104,28 +186,55 @@ Window::Window(MainWindow* mw)
 
 	setLayout(mainLayout);
 
-	xSlider->setValue(15 * 16);
-	ySlider->setValue(345 * 16);
-	zSlider->setValue(0 * 16);
+	transfer->setCurrentIndex(options.transfer);
+	interpolation->setCurrentIndex(options.interpolation);
+	complex_view->setCurrentIndex(std::max(0, options.complex_view - 1));
+	xSlider->setValue(0);
+	ySlider->setValue(GLWidget::pan_max / 2);
+	zSlider->setValue(GLWidget::pan_max / 2);
 
 	setWindowTitle(tr("Hello GL"));
 
-	redraw_timer = new QTimer();
-	redraw_timer->start(17);
+	if (!options.ingest_shm.empty() || !options.ingest_socket.empty())
+	{
+		ingest = std::make_unique<IngestServer>(glWidget, glWidget->columnCount());
+		bool ok = options.ingest_shm.empty() || ingest->listen_shm(options.ingest_shm, options.ingest_slots);
+		ok = (options.ingest_socket.empty() || ingest->listen_socket(options.ingest_socket)) && ok;
+		if (ok)
+			ingest->start();
+		else
+			ingest.reset();
+	}
 
-	connect(redraw_timer, &QTimer::timeout, glWidget, &GLWidget::issue_redraw);
+	if (ingest)
+		return; // external producers only
+	if (recording)
+	{
+		replay = std::make_unique<ReplaySource>(glWidget, recording, options.replay_rate);
+		replay->start();
+	}
+	else
+	{
+		load_gen = std::make_unique<LoadGenerator>(glWidgets, options);
+		load_gen->start();
+	}
+}
 
-	data_gen = std::make_unique<std::thread>(MockDataSource(glWidget));
-	data_gen->detach();
+Window::~Window()
+{
+	// the widgets are deleted with the layout after this, stop everything writing to them first
+	replay.reset();
+	load_gen.reset();
+	ingest.reset();
 }
 
-QSlider* Window::createSlider()
+QSlider* Window::createSlider(int max)
 {
 	QSlider* slider = new QSlider(Qt::Vertical);
-	slider->setRange(0, 360 * 16);
-	slider->setSingleStep(16);
-	slider->setPageStep(15 * 16);
-	slider->setTickInterval(15 * 16);
+	slider->setRange(0, max);
+	slider->setSingleStep(max / 100);
+	slider->setPageStep(max / 10);
+	slider->setTickInterval(max / 10);
 	slider->setTickPosition(QSlider::TicksRight);
 	return slider;
 }
@@ -172,46 +281,3 @@ void Window::dockUndock()
 }
 
 void Window::genData() {}
-
-void Window::MockDataSource::operator()()
-{
-	using namespace std::chrono_literals;
-	using namespace std::chrono;
-
-	const auto target_dps = 1200;
-	const auto max_sleep_time = nanoseconds(1000000000 / target_dps);
-
-	std::default_random_engine generator;
-	std::uniform_real_distribution<float> distribution(-1.0, 1.0);
-	float pos = 1000.f;
-	while (true)
-	{
-		auto start = steady_clock::now();
-		pos += 8.0 * distribution(generator);
-
-		std::vector<float> v(2000, 0.0f);
-		for (int i = std::max(0, int(pos - 40)); i < std::min(2000, int(pos + 40)); i++)
-		{
-			v[i] = exp(-(i - pos) * (i - pos) / 100.0);
-		}
-		w->append(v);
-
-		if (++n_count % 10000 == 0)
-		{
-			float ms = dps.elapsed() * 1e-3;
-			if (ms > 0)
-			{
-				auto dps = 10000 / ms;
-				std::cerr << "DPS: " << dps << "\n";
-			}
-			n_count = 0;
-			dps.start();
-		}
-
-		auto end = steady_clock::now();
-		auto append_time = duration_cast<nanoseconds>(end - start);
-		auto sleep_time = max_sleep_time - append_time;
-
-		std::this_thread::sleep_for(sleep_time);
-	}
-}
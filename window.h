@@ -54,7 +54,10 @@
 #include <QTime>
 #include <QTimer>
 #include <QWidget>
-#include <thread>
+#include <memory>
+#include <vector>
+
+#include "streamoptions.h"
 
 QT_BEGIN_NAMESPACE
 class QSlider;
@@ -62,14 +65,18 @@ class QPushButton;
 QT_END_NAMESPACE
 
 class GLWidget;
+class IngestServer;
+class LoadGenerator;
 class MainWindow;
+class ReplaySource;
 
 class Window : public QWidget
 {
 	Q_OBJECT
 
 public:
-	Window(MainWindow* mw);
+	Window(MainWindow* mw, const StreamOptions& options);
+	~Window();
 
 protected:
 	void keyPressEvent(QKeyEvent* event) override;
@@ -79,30 +86,19 @@ private slots:
 	void genData();
 
 private:
-	QSlider* createSlider();
+	QSlider* createSlider(int max);
 
-	GLWidget* glWidget;
-	QSlider* xSlider;
-	QSlider* ySlider;
-	QSlider* zSlider;
+	std::vector<GLWidget*> glWidgets;
+	QSlider* xSlider; ///< zoom
+	QSlider* ySlider; ///< pan along the rows
+	QSlider* zSlider; ///< pan along the columns
 	QPushButton* dockBtn;
 	MainWindow* mainWindow;
 	QTimer* redraw_timer;
 	QTimer* insert_timer;
-	std::unique_ptr<std::thread> data_gen;
-
-	struct MockDataSource
-	{
-		MockDataSource(GLWidget* widget)
-			: n_count(0)
-			, w(widget)
-		{
-		}
-		void operator()();
-		long n_count;
-		GLWidget* w;
-		QTime dps;
-	};
+	std::unique_ptr<ReplaySource> replay;
+	std::unique_ptr<IngestServer> ingest;
+	std::unique_ptr<LoadGenerator> load_gen;
 };
 
 #endif